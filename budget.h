@@ -0,0 +1,20 @@
+#include <stdlib.h>
+
+/*
+ * Execution limits for running untrusted scripts. The instruction budget is
+ * charged only at backward branches (by the distance jumped) and at calls, the
+ * time budget is checked every few thousand charged instructions and the
+ * memory budget counts the bytes allocated by NEW and MAKE_ARRAY and by the
+ * strings, builders, maps, streams and views that natives create. A zero
+ * field means no limit.
+ */
+typedef struct budget {
+    long instructions;
+    long time_ms;
+    long memory;
+} Budget;
+
+#define EXEC_OK 0
+#define EXEC_INSTRUCTION_BUDGET_EXCEEDED 1
+#define EXEC_TIME_BUDGET_EXCEEDED 2
+#define EXEC_MEMORY_BUDGET_EXCEEDED 3
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "env.h"
+#include "opcodes.h"
+#include "debug.h"
+
+
+Debugger* debug_open(){
+    char* source = getenv("RABBIT_DEBUG");
+    if (source == NULL || strcmp(source, "0") == 0) return NULL;
+
+    FILE* in = stdin;
+    if (strcmp(source, "1") != 0 && strcmp(source, "stdin") != 0){
+        in = fopen(source, "r");
+        if (in == NULL){
+            fprintf(stderr, "%s%s%s", "can not open debugger input '", source, "'\n");
+            return NULL;
+        }
+    }
+
+    Debugger* debugger = malloc(sizeof(Debugger));
+    debugger->in = in;
+    debugger->patch_count = 0;
+    debugger->patch_capacity = 8;
+    debugger->patches = malloc(sizeof(Patch) * debugger->patch_capacity);
+    debugger->pending_count = 0;
+    debugger->pending_capacity = 8;
+    debugger->pending = malloc(sizeof(Pending_Break) * debugger->pending_capacity);
+    return debugger;
+}
+
+void add_patch(Debugger* debugger, V_Function* function, int index, int temporary){
+    if (debugger->patch_count == debugger->patch_capacity){
+        debugger->patch_capacity *= 2;
+        debugger->patches = realloc(debugger->patches, sizeof(Patch) * debugger->patch_capacity);
+    }
+
+    Breakpoint_Inst* breakpoint = malloc(sizeof(Breakpoint_Inst));
+    breakpoint->opcode = BREAKPOINT;
+    breakpoint->original = function->instructions[index];
+    function->instructions[index] = (u_int8_t*) breakpoint;
+
+    Patch* patch = &debugger->patches[debugger->patch_count++];
+    patch->function = function;
+    patch->index = index;
+    patch->temporary = temporary;
+}
+
+void remove_patch(Debugger* debugger, int i){
+    Patch* patch = &debugger->patches[i];
+    Breakpoint_Inst* breakpoint = (Breakpoint_Inst*) patch->function->instructions[patch->index];
+    patch->function->instructions[patch->index] = breakpoint->original;
+    free(breakpoint);
+    debugger->patches[i] = debugger->patches[--debugger->patch_count];
+}
+
+void remove_patches(Debugger* debugger, int temporary_only){
+    for (int i = debugger->patch_count - 1; i >= 0; i--){
+        if (!temporary_only || debugger->patches[i].temporary)
+            remove_patch(debugger, i);
+    }
+}
+
+int is_line(u_int8_t* inst, int line){
+    return inst[0] == NEW_LINE && (line == -1 || ((inst[1] << 8) | inst[2]) == line);
+}
+
+/* patches every NEW_LINE of 'line' (or every line if -1) in 'function' */
+int patch_line(Debugger* debugger, V_Function* function, int line, int temporary){
+    int patched = 0;
+    for (int i = 0; i < function->length; i++){
+        if (is_line(function->instructions[i], line)){
+            add_patch(debugger, function, i, temporary);
+            patched++;
+        }
+    }
+    return patched;
+}
+
+int unpatch_line(Debugger* debugger, V_Function* function, int line){
+    int removed = 0;
+    for (int i = debugger->patch_count - 1; i >= 0; i--){
+        Patch* patch = &debugger->patches[i];
+        Breakpoint_Inst* breakpoint = (Breakpoint_Inst*) patch->function->instructions[patch->index];
+        if (patch->function == function && is_line(breakpoint->original, line)){
+            remove_patch(debugger, i);
+            removed++;
+        }
+    }
+    return removed;
+}
+
+void add_pending(Debugger* debugger, V_Function* function, int line){
+    if (debugger->pending_count == debugger->pending_capacity){
+        debugger->pending_capacity *= 2;
+        debugger->pending = realloc(debugger->pending, sizeof(Pending_Break) * debugger->pending_capacity);
+    }
+    Pending_Break* pending = &debugger->pending[debugger->pending_count++];
+    pending->function = function;
+    pending->line = line;
+}
+
+int remove_pending(Debugger* debugger, V_Function* function, int line){
+    int removed = 0;
+    for (int i = debugger->pending_count - 1; i >= 0; i--){
+        Pending_Break* pending = &debugger->pending[i];
+        if (pending->function == function && (line == -1 || pending->line == line)){
+            debugger->pending[i] = debugger->pending[--debugger->pending_count];
+            removed++;
+        }
+    }
+    return removed;
+}
+
+void debug_prepared(Debugger* debugger, V_Function* function){
+    for (int i = 0; i < debugger->pending_count; i++){
+        if (debugger->pending[i].function == function)
+            patch_line(debugger, function, debugger->pending[i].line, FALSE);
+    }
+    remove_pending(debugger, function, -1);
+}
+
+/* single stepping stops at the next line of any function that is already decoded */
+void patch_step(Context* ctx, Debugger* debugger){
+    for (int i = 0; i < get_pool_size(ctx); i++){
+        if (get_pool_tag(ctx, i) != 3) continue;
+        V_Function* function = get_pool_value(ctx, i);
+        if (function->instructions != NULL)
+            patch_line(debugger, function, -1, TRUE);
+    }
+}
+
+void print_values(char* kind, void** values, int count){
+    for (int i = 0; i < count; i++)
+        fprintf(stderr, "  %s[%d] = %ld (0x%lx)\n", kind, i, (long) values[i], (unsigned long) values[i]);
+}
+
+void print_location(Context* ctx){
+    Frame_Info info;
+    if (get_frame_info(ctx, 0, &info))
+        fprintf(stderr, "stopped in %s: line %d\n", info.function->name, info.line);
+}
+
+void print_stack(Context* ctx){
+    Frame_Info info;
+    for (int depth = 0; get_frame_info(ctx, depth, &info); depth++)
+        fprintf(stderr, "  #%d %s: line %d\n", depth, info.function->name, info.line);
+}
+
+void debug_stop(Context* ctx){
+    Debugger* debugger = get_debugger(ctx);
+    remove_patches(debugger, TRUE);
+    print_location(ctx);
+
+    char line[256];
+    char name[200];
+    int number;
+    Frame_Info info;
+
+    while (fprintf(stderr, "(rdb) "), fgets(line, sizeof(line), debugger->in) != NULL){
+        if (sscanf(line, "break %199s %d", name, &number) == 2){
+            V_Function* function = find_function(ctx, name);
+            if (function != NULL && function->instructions == NULL){
+                /* its arity is not known yet, so it can not be decoded and verified now */
+                add_pending(debugger, function, number);
+                fprintf(stderr, "breakpoint pending at %s: line %d\n", name, number);
+            }
+            else if (function == NULL || patch_line(debugger, function, number, FALSE) == 0)
+                fprintf(stderr, "no line %d in '%s'\n", number, name);
+            else
+                fprintf(stderr, "breakpoint at %s: line %d\n", name, number);
+        }
+        else if (sscanf(line, "delete %199s %d", name, &number) == 2){
+            V_Function* function = find_function(ctx, name);
+            if (function == NULL || unpatch_line(debugger, function, number) + remove_pending(debugger, function, number) == 0)
+                fprintf(stderr, "no breakpoint at %s: line %d\n", name, number);
+        }
+        else if (strncmp(line, "step", 4) == 0 || strcmp(line, "s\n") == 0){
+            patch_step(ctx, debugger);
+            return;
+        }
+        else if (strncmp(line, "continue", 8) == 0 || strcmp(line, "c\n") == 0){
+            return;
+        }
+        else if (strncmp(line, "stack", 5) == 0 || strncmp(line, "bt", 2) == 0){
+            print_stack(ctx);
+        }
+        else if (strncmp(line, "locals", 6) == 0 && get_frame_info(ctx, 0, &info)){
+            print_values("local", info.locals, info.function->locals);
+        }
+        else if (strncmp(line, "operands", 8) == 0 && get_frame_info(ctx, 0, &info)){
+            print_values("operand", info.op_stack, info.sp);
+        }
+        else if (strncmp(line, "quit", 4) == 0){
+            remove_patches(debugger, FALSE);
+            return;
+        }
+        else if (line[0] != '\n'){
+            fprintf(stderr, "unknown command: %s", line);
+        }
+    }
+    /* input closed: detach and let the program run to completion */
+    remove_patches(debugger, FALSE);
+}
+
+void debug_close(Debugger* debugger){
+    remove_patches(debugger, FALSE);
+    if (debugger->in != stdin)
+        fclose(debugger->in);
+    free(debugger->patches);
+    free(debugger->pending);
+    free(debugger);
+}
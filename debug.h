@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Line debugger, enabled with RABBIT_DEBUG set to "1" (commands from stdin) or
+ * to a file/fifo to read commands from. Breakpoints are BREAKPOINT instructions
+ * patched over the NEW_LINE of the requested line and removed again on delete,
+ * so code without breakpoints runs exactly as without a debugger. A breakpoint in
+ * a function that has not been decoded yet waits until the function is decoded.
+ *
+ * Commands: break <function> <line>, delete <function> <line>, step,
+ * continue, stack, locals, operands, quit.
+ */
+struct context;
+struct v_function;
+
+typedef struct patch {
+    struct v_function* function;
+    int index;
+    int temporary;
+} Patch;
+
+/* a breakpoint in a function that is not decoded yet, patched in once it is */
+typedef struct pending_break {
+    struct v_function* function;
+    int line;
+} Pending_Break;
+
+typedef struct debugger {
+    FILE* in;
+    int patch_count;
+    int patch_capacity;
+    Patch* patches;
+    int pending_count;
+    int pending_capacity;
+    Pending_Break* pending;
+} Debugger;
+
+Debugger* debug_open();
+
+void debug_stop(struct context* ctx);
+
+/* called when 'function' has been decoded, applies its pending breakpoints */
+void debug_prepared(Debugger* debugger, struct v_function* function);
+
+void debug_close(Debugger* debugger);
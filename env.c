@@ -1,11 +1,22 @@
 #include "stdlib.h"
 #include "load.h"
+#include "env.h"
 #include "utils.h"
+#include "str.h"
+#include "trace.h"
+#include "profile.h"
+#include "debug.h"
+#include "parallel.h"
+#include "verify.h"
 #include <stdio.h>
+#include <limits.h>
+#include <time.h>
+#include <string.h>
 
 typedef struct frame Frame;
 
 typedef struct frame {
+    V_Function* function;
     char* name;
     void** locals;
     void** op_stack;
@@ -17,10 +28,33 @@ typedef struct frame {
 } Frame;
 
 
+#define TIME_CHECK_INTERVAL 4096
+
+typedef struct budget_state {
+    long remaining;
+    long next_check;
+    long deadline;
+    long memory_left;
+} Budget_State;
+
+
 typedef struct context {
     Loaded* areas;
     Frame* top_frame;
     int call_stack_size;
+    Trace* trace;
+    Heap_Profile* profile;
+    Debugger* debugger;
+    jmp_buf* unwind;
+    Budget_State budget;
+    /* the budget instructions are settled against and memory is drawn from: the root context's */
+    Budget_State* shared;
+    int status;
+    /* an exception no frame of a worker caught, rethrown by the thread that started the job */
+    R_Object* exception;
+    Context* parent;
+    Workers* workers;
+    void* result;
 } Context;
 
 Context* init_components(char* file_name) {
@@ -28,9 +62,93 @@ Context* init_components(char* file_name) {
     Context *ctx = malloc(sizeof(Context));
     ctx->areas = loaded;
     ctx->top_frame = NULL;
+    ctx->call_stack_size = 0;
+    ctx->trace = trace_open();
+    ctx->profile = profile_open();
+    ctx->debugger = debug_open();
+    loaded->debugger = ctx->debugger;
+    ctx->unwind = NULL;
+    ctx->status = EXEC_OK;
+    ctx->exception = NULL;
+    ctx->shared = &ctx->budget;
+    set_budget(ctx, NULL);
+    ctx->parent = NULL;
+    ctx->workers = NULL;
+    ctx->result = NULL;
     return ctx;
 }
 
+/* worker contexts share the loaded image but have their own frames and no tracing, profiling or debugging */
+Context* new_worker_context(Context* parent){
+    Context *ctx = malloc(sizeof(Context));
+    ctx->areas = parent->areas;
+    ctx->top_frame = NULL;
+    ctx->call_stack_size = 0;
+    ctx->trace = NULL;
+    ctx->profile = NULL;
+    ctx->debugger = NULL;
+    ctx->unwind = NULL;
+    ctx->status = EXEC_OK;
+    ctx->exception = NULL;
+    /* a worker counts instructions locally and settles them with the shared budget in batches */
+    ctx->shared = parent->shared;
+    ctx->budget.remaining = 0;
+    ctx->budget.next_check = -TIME_CHECK_INTERVAL;
+    ctx->budget.deadline = 0;
+    ctx->budget.memory_left = 0;
+    ctx->parent = parent;
+    ctx->workers = NULL;
+    ctx->result = NULL;
+    return ctx;
+}
+
+void free_worker_context(Context* ctx){
+    settle_budget(ctx);
+    while (ctx->top_frame != NULL){
+        pop_frame(ctx);
+    }
+    free(ctx);
+}
+
+Workers* get_workers(Context* ctx){
+    if (ctx->parent != NULL) return NULL;
+    if (ctx->workers == NULL)
+        ctx->workers = workers_open(ctx);
+    return ctx->workers;
+}
+
+void detach_child(Context* ctx){
+    ctx->workers = NULL;
+    if (ctx->trace != NULL)
+        trace_fork(ctx->trace);
+}
+
+void close_child(Context* ctx){
+    if (ctx->trace != NULL)
+        trace_close(ctx->trace);
+    if (ctx->profile != NULL)
+        profile_close(ctx->profile);
+    ctx->trace = NULL;
+    ctx->profile = NULL;
+}
+
+/* instructions are only rewritten by the main context, workers read them concurrently */
+bool may_rewrite(Context* ctx){
+    return ctx->parent == NULL;
+}
+
+bool is_worker(Context* ctx){
+    return ctx->parent != NULL;
+}
+
+void set_result(Context* ctx, void* value){
+    ctx->result = value;
+}
+
+void* get_result(Context* ctx){
+    return ctx->result;
+}
+
 u_int8_t get_main_address(Context* ctx){
     return ctx->areas->main_addr;
 }
@@ -44,6 +162,62 @@ void* get_pool_value(Context* ctx, int idx){
     return ctx->areas->pool->values[idx];
 }
 
+int get_pool_size(Context* ctx){
+    return ctx->areas->pool->size;
+}
+
+V_Function* find_function(Context* ctx, char* name){
+    for (int i = 0; i < get_pool_size(ctx); i++){
+        if (get_pool_tag(ctx, i) != 3) continue;
+        V_Function* function = get_pool_value(ctx, i);
+        if (strcmp(function->name, name) != 0) continue;
+        /* a function nothing has called yet is returned undecoded */
+        return function->arity == -1 ? function : get_function(ctx, i);
+    }
+    return NULL;
+}
+
+V_Function* find_entry_point(Context* ctx, char* name, int argc){
+    for (int i = 0; i < get_pool_size(ctx); i++){
+        if (get_pool_tag(ctx, i) != 3) continue;
+        V_Function* function = get_pool_value(ctx, i);
+        if (strcmp(function->name, name) != 0) continue;
+        if (function->arity != -1 && function->arity != argc) return NULL;
+
+        function->arity = argc;
+        /* an eager image only verified what main reaches */
+        if (ctx->areas->minor == 1)
+            verify_reachable(ctx->areas->pool, ctx->areas->main_addr);
+        return get_function(ctx, i);
+    }
+    return NULL;
+}
+
+V_Function* get_function(Context* ctx, int idx){
+    V_Function* function = ctx->areas->pool->values[idx];
+    if (function->instructions == NULL)
+        prepare_function(ctx->areas, function);
+    return function;
+}
+
+/*
+ * Decodes every function that decoded code can call, i.e. every function whose
+ * arity is known, so that workers never have to decode lazily.
+ */
+void prepare_referenced(Context* ctx){
+    bool changed = TRUE;
+    while (changed){
+        changed = FALSE;
+        for (int i = 0; i < get_pool_size(ctx); i++){
+            if (get_pool_tag(ctx, i) != 3) continue;
+            V_Function* function = get_pool_value(ctx, i);
+            if (function->instructions != NULL || function->arity == -1) continue;
+            prepare_function(ctx->areas, function);
+            changed = TRUE;
+        }
+    }
+}
+
 void* load_local(Context* ctx, int idx){
     return ctx->top_frame->locals[idx];
 }
@@ -64,33 +238,69 @@ char* curr_func_name(Context* ctx){
     return ctx->top_frame->name;
 }
 
+V_Function* curr_function(Context* ctx){
+    return ctx->top_frame->function;
+}
+
+/* index of the instruction that was fetched last */
+int curr_instruction(Context* ctx){
+    return ctx->top_frame->ip - 1;
+}
+
+void clear_op_stack(Context* ctx){
+    ctx->top_frame->sp = 0;
+}
+
 u_int8_t* fetch(Context* ctx){
     return ctx->top_frame->instructions[ctx->top_frame->ip++];
 }
 
 
-Frame* init_frame(char* name, int locals, int op_stack, u_int8_t** instructions){
+static Type ARRAY_TYPE = {.size = 0, .name = "arr"};
+
+R_Object* new_array(int size){
+    R_Object* arr = malloc(sizeof(R_Object) + sizeof(void*) * (size+1));
+    arr->type = &ARRAY_TYPE;
+    arr->content = (void**)(arr + 1);
+    arr->content[0] = (void*)(long)size;
+    return arr;
+}
+
+int array_length(R_Object* arr){
+    return (int)(long)arr->content[0];
+}
+
+
+Frame* init_frame(V_Function* function){
     Frame* new_frame = malloc(sizeof(Frame));
-    new_frame->name = name;
+    new_frame->function = function;
+    new_frame->name = function->name;
     new_frame->sp = 0;
     new_frame->ip = 0;
-    new_frame->locals = malloc(sizeof(void*) * locals);
-    new_frame->op_stack = malloc(sizeof(void*) * op_stack);
-    new_frame->instructions = instructions;
+    new_frame->locals = malloc(sizeof(void*) * function->locals);
+    new_frame->op_stack = malloc(sizeof(void*) * function->op_stack);
+    new_frame->instructions = function->instructions;
     new_frame->line = -1;
     return new_frame;
 }
 
-void push_frame(Context* ctx, char* name, int locals, int op_stack, u_int8_t** instructions){
-    Frame* new_top = init_frame(name, locals, op_stack, instructions);
+void push_frame(Context* ctx, V_Function* function){
+    Frame* new_top = init_frame(function);
     Frame* old_top = ctx->top_frame;
     new_top->prev = old_top;
     ctx->top_frame = new_top;
     ctx->call_stack_size++;
+
+    if (ctx->trace != NULL){
+        trace_poll(ctx->trace);
+        trace_event(ctx->trace, TRACE_ENTER, function->name, 0);
+    }
 }
 
 void pop_frame(Context* ctx){
     Frame* top = ctx->top_frame;
+    if (ctx->trace != NULL)
+        trace_event(ctx->trace, TRACE_EXIT, top->name, 0);
     ctx->top_frame = top->prev;
     free(top->locals);
     free(top->op_stack);
@@ -106,6 +316,27 @@ int get_frame_stack_size(Context* ctx){
     return ctx->call_stack_size;
 }
 
+/* depth 0 is the innermost frame */
+bool get_frame_info(Context* ctx, int depth, Frame_Info* info){
+    Frame* frame = ctx->top_frame;
+    while (frame != NULL && depth-- > 0) frame = frame->prev;
+    if (frame == NULL) return FALSE;
+
+    info->function = frame->function;
+    info->line = frame->line;
+    info->locals = frame->locals;
+    info->op_stack = frame->op_stack;
+    info->sp = frame->sp;
+    return TRUE;
+}
+
+/* replaces the instruction that was fetched last */
+void rewrite_instruction(Context* ctx, u_int8_t* instruction){
+    Frame* frame = ctx->top_frame;
+    free(frame->instructions[frame->ip - 1]);
+    frame->instructions[frame->ip - 1] = instruction;
+}
+
 void jump_to(Context* ctx, int address){
     ctx->top_frame->ip = address;
 }
@@ -118,12 +349,138 @@ int get_curr_line(Context* ctx){
     return ctx->top_frame->line;
 }
 
+Trace* get_trace(Context* ctx){
+    return ctx->trace;
+}
+
+Heap_Profile* get_heap_profile(Context* ctx){
+    return ctx->profile;
+}
+
+Debugger* get_debugger(Context* ctx){
+    return ctx->debugger;
+}
+
+void set_unwind_target(Context* ctx, jmp_buf* target){
+    ctx->unwind = target;
+}
+
+jmp_buf* get_unwind_target(Context* ctx){
+    return ctx->unwind;
+}
+
+
+long now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+void set_budget(Context* ctx, Budget* budget){
+    Budget_State* state = &ctx->budget;
+    state->remaining = budget != NULL && budget->instructions > 0 ? budget->instructions : LONG_MAX;
+    state->memory_left = budget != NULL && budget->memory > 0 ? budget->memory : LONG_MAX;
+    state->deadline = budget != NULL && budget->time_ms > 0 ? now_ms() + budget->time_ms : 0;
+    state->next_check = state->deadline != 0 ? state->remaining - TIME_CHECK_INTERVAL : 0;
+}
+
+char* status_reason(int status){
+    switch (status) {
+        case EXEC_INSTRUCTION_BUDGET_EXCEEDED: return "instruction budget exceeded";
+        case EXEC_TIME_BUDGET_EXCEEDED: return "time budget exceeded";
+        case EXEC_MEMORY_BUDGET_EXCEEDED: return "memory budget exceeded";
+        default: return "execution aborted";
+    }
+}
+
+/* leaves the interpreter loop; exec reports 'status' to the host, a worker's is reported by its job */
+void abort_execution(Context* ctx, int status){
+    if (!is_worker(ctx))
+        fprintf(stderr, "%s%s%s%s%d%s", status_reason(status), " (in ", curr_func_name(ctx), ": line ", get_curr_line(ctx), ")\n");
+    ctx->status = status;
+    longjmp(*ctx->unwind, 2);
+}
+
+void settle_budget(Context* ctx){
+    Budget_State* state = &ctx->budget;
+    if (ctx->shared == state || state->remaining == 0) return;
+    __atomic_add_fetch(&ctx->shared->remaining, state->remaining, __ATOMIC_RELAXED);
+    state->remaining = 0;
+    state->next_check = -TIME_CHECK_INTERVAL;
+}
+
+void check_budget(Context* ctx){
+    Budget_State* state = &ctx->budget;
+    if (ctx->shared != state){
+        settle_budget(ctx);
+        if (__atomic_load_n(&ctx->shared->remaining, __ATOMIC_RELAXED) < 0)
+            abort_execution(ctx, EXEC_INSTRUCTION_BUDGET_EXCEEDED);
+        if (ctx->shared->deadline != 0 && now_ms() > ctx->shared->deadline)
+            abort_execution(ctx, EXEC_TIME_BUDGET_EXCEEDED);
+        return;
+    }
+    if (state->remaining < 0)
+        abort_execution(ctx, EXEC_INSTRUCTION_BUDGET_EXCEEDED);
+    if (state->deadline != 0){
+        if (now_ms() > state->deadline)
+            abort_execution(ctx, EXEC_TIME_BUDGET_EXCEEDED);
+        state->next_check = state->remaining - TIME_CHECK_INTERVAL;
+    }
+}
+
+void charge_budget(Context* ctx, long instructions){
+    ctx->budget.remaining -= instructions;
+    if (ctx->budget.remaining < ctx->budget.next_check)
+        check_budget(ctx);
+}
+
+void charge_memory(Context* ctx, long bytes){
+    if (__atomic_sub_fetch(&ctx->shared->memory_left, bytes, __ATOMIC_RELAXED) < 0)
+        abort_execution(ctx, EXEC_MEMORY_BUDGET_EXCEEDED);
+}
+
+int get_exit_status(Context* ctx){
+    return ctx->status;
+}
+
+void fail_worker(Context* ctx, R_Object* exception){
+    ctx->exception = exception;
+    longjmp(*ctx->unwind, 2);
+}
+
+R_Object* get_exception(Context* ctx){
+    return ctx->exception;
+}
+
+bool has_failed(Context* ctx){
+    return ctx->status != EXEC_OK || ctx->exception != NULL;
+}
+
+void set_failure(Context* ctx, int status, R_Object* exception){
+    ctx->status = status;
+    ctx->exception = exception;
+}
+
 
 void clean_up(Context* ctx){
+    if (ctx->parent != NULL){
+        free_worker_context(ctx);
+        return;
+    }
     while (ctx->top_frame != NULL){
         pop_frame(ctx);
     }
+    if (ctx->workers != NULL)
+        workers_close(ctx->workers);
+    if (ctx->trace != NULL)
+        trace_close(ctx->trace);
+    if (ctx->profile != NULL)
+        profile_close(ctx->profile);
+    if (ctx->debugger != NULL)
+        debug_close(ctx->debugger);
     free_pool(ctx->areas->pool);
+    free_strings();
+    free(ctx->areas->image);
     free(ctx->areas);
     free(ctx);
 }
@@ -1,11 +1,21 @@
 #include "utils.h"
 #include "stdlib.h"
+#include "budget.h"
+#include <setjmp.h>
 
 typedef struct v_function {
     char* name;
     u_int8_t locals;
     u_int8_t op_stack;
+    int length;
     u_int8_t** instructions;
+    u_int8_t* code;
+    int code_size;
+    int raw_size;
+    int arity;
+    bool verified;
+    int handler_count;
+    struct handler* handlers;
 } V_Function;
 
 typedef struct v_method_table {
@@ -14,13 +24,34 @@ typedef struct v_method_table {
     int* addresses;
 } V_Method_Table;
 
+/* kinds of packed fields; a reference takes a full slot, primitives their natural size */
+enum Field_Kind {
+    FIELD_REF,
+    FIELD_I8,
+    FIELD_I32,
+    FIELD_F32,
+};
+
 typedef struct type {
     u_int8_t size;
     char* name;
     V_Method_Table* v_methods;
+    /* NULL if every field is a reference slot, otherwise per field kind and byte offset */
+    u_int8_t* kinds;
+    u_int16_t* offsets;
+    int bytes;
 } Type;
 
 
+/* catches exceptions thrown by instructions start..end-1; a NULL type catches everything */
+typedef struct handler {
+    int start;
+    int end;
+    int target;
+    Type* type;
+} Handler;
+
+
 typedef struct r_object R_Object;
 
 typedef struct r_object {
@@ -30,6 +61,26 @@ typedef struct r_object {
 
 typedef struct context Context;
 
+V_Function* get_function(Context* ctx, int idx);
+
+typedef struct trace Trace;
+
+typedef struct heap_profile Heap_Profile;
+
+typedef struct debugger Debugger;
+
+typedef struct frame_info {
+    V_Function* function;
+    int line;
+    void** locals;
+    void** op_stack;
+    int sp;
+} Frame_Info;
+
+R_Object* new_array(int size);
+
+int array_length(R_Object* arr);
+
 u_int8_t get_main_address(Context* ctx);
 
 Context* init_components(char* file_name);
@@ -40,6 +91,13 @@ int get_pool_tag(Context* ctx, int idx);
 
 void* get_pool_value(Context* ctx, int idx);
 
+int get_pool_size(Context* ctx);
+
+V_Function* find_function(Context* ctx, char* name);
+
+/* finds a function the host calls with 'argc' arguments, NULL if there is none or its arity differs */
+V_Function* find_entry_point(Context* ctx, char* name, int argc);
+
 void* load_local(Context* ctx, int idx);
 
 void store_local(Context* ctx, int idx, void* value);
@@ -50,9 +108,15 @@ void op_stack_push(Context* ctx, void* value);
 
 char* curr_func_name(Context* ctx);
 
+V_Function* curr_function(Context* ctx);
+
+int curr_instruction(Context* ctx);
+
+void clear_op_stack(Context* ctx);
+
 u_int8_t* fetch(Context* ctx);
 
-void push_frame(Context* ctx, char* name, int locals, int op_stack, u_int8_t** instructions);
+void push_frame(Context* ctx, V_Function* function);
 
 void pop_frame(Context* ctx);
 
@@ -60,8 +124,73 @@ bool frame_stack_is_empty(Context* ctx);
 
 int get_frame_stack_size(Context* ctx);
 
+bool get_frame_info(Context* ctx, int depth, Frame_Info* info);
+
+void rewrite_instruction(Context* ctx, u_int8_t* instruction);
+
 void jump_to(Context* ctx, int address);
 
 void set_line(Context* ctx, int line);
 
 int get_curr_line(Context* ctx);
+
+Trace* get_trace(Context* ctx);
+
+Heap_Profile* get_heap_profile(Context* ctx);
+
+Debugger* get_debugger(Context* ctx);
+
+void set_unwind_target(Context* ctx, jmp_buf* target);
+
+jmp_buf* get_unwind_target(Context* ctx);
+
+void set_budget(Context* ctx, Budget* budget);
+
+void charge_budget(Context* ctx, long instructions);
+
+void charge_memory(Context* ctx, long bytes);
+
+/* adds what a worker charged since the last check to the shared budget */
+void settle_budget(Context* ctx);
+
+/* prints the reason unless ctx is a worker and leaves the interpreter loop with 'status' */
+void abort_execution(Context* ctx, int status);
+
+int get_exit_status(Context* ctx);
+
+/* leaves a worker's interpreter loop with an exception none of its frames caught */
+void fail_worker(Context* ctx, R_Object* exception);
+
+R_Object* get_exception(Context* ctx);
+
+/* a worker left its loop through fail_worker or an exceeded budget */
+bool has_failed(Context* ctx);
+
+void set_failure(Context* ctx, int status, R_Object* exception);
+
+typedef struct workers Workers;
+
+Context* new_worker_context(Context* parent);
+
+void free_worker_context(Context* ctx);
+
+Workers* get_workers(Context* ctx);
+
+/* in a forked child: drops the thread pool, whose threads do not exist, and moves the trace to its own file */
+void detach_child(Context* ctx);
+
+/* a child ends with _exit, so its trace and heap profile are written here */
+void close_child(Context* ctx);
+
+bool may_rewrite(Context* ctx);
+
+bool is_worker(Context* ctx);
+
+void prepare_referenced(Context* ctx);
+
+void set_result(Context* ctx, void* value);
+
+void* get_result(Context* ctx);
+
+/* defined in thread.c: runs 'function' on a context without frames and returns its result */
+void* run_function(Context* ctx, V_Function* function, void** args, int argc);
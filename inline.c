@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "load.h"
+#include "env.h"
+#include "opcodes.h"
+#include "verify.h"
+#include "inline.h"
+
+#define INLINE_MAX_LENGTH 8
+#define INLINE_MAX_BODY_SIZE 64
+#define MAX_FUNCTION_LENGTH 65536
+
+#define LINE_UNSEEN (-2)
+#define LINE_MIXED (-3)
+
+
+bool inline_enabled(){
+    char* value = getenv("RABBIT_INLINE");
+    return value == NULL || strcmp(value, "0") != 0;
+}
+
+bool inline_report(){
+    char* value = getenv("RABBIT_INLINE_REPORT");
+    return value != NULL && strcmp(value, "0") != 0;
+}
+
+/* straight-line code without calls whose only RETURN is its last instruction and leaves one value */
+bool is_inlinable(V_Function* callee){
+    if (!callee->verified || callee->length > INLINE_MAX_LENGTH || callee->handler_count != 0)
+        return FALSE;
+
+    int depth = callee->arity;
+    for (int i = 0; i < callee->length; i++){
+        u_int8_t* inst = callee->instructions[i];
+        switch (inst[0]) {
+            case RETURN:
+                return i == callee->length - 1 && depth == 1;
+
+            case INVOKE_VIRTUAL:
+            case INVOKE_TEMPLATE:
+            case GOTO:
+            case BRANCH_ZERO:
+            case BRANCH_NOT_ZERO:
+            case TABLESWITCH:
+            case LOOKUPSWITCH:
+            case THROW:
+            case PAR_MAP:
+            case PAR_FILTER:
+            case PAR_REDUCE:
+                return FALSE;
+
+            default:
+                /* quickened or patched instructions can not be copied, except for constants */
+                if (inst[0] > PUSH_CONST) return FALSE;
+                depth += stack_effect(inst);
+        }
+    }
+    return FALSE;
+}
+
+bool sets_line(V_Function* callee){
+    for (int i = 0; i < callee->length; i++)
+        if (callee->instructions[i][0] == NEW_LINE) return TRUE;
+    return FALSE;
+}
+
+/* the body without its RETURN, followed by a NEW_LINE restoring the caller's line if the callee sets its own */
+int inlined_length(V_Function* callee){
+    return callee->length - 1 + (sets_line(callee) ? 1 : 0);
+}
+
+bool merge_line(int* lines, int at, int line){
+    int merged = lines[at] == LINE_UNSEEN || lines[at] == line ? line : LINE_MIXED;
+    if (merged == lines[at]) return FALSE;
+    lines[at] = merged;
+    return TRUE;
+}
+
+/* the line in effect before every instruction, LINE_MIXED where paths with different lines meet */
+int* caller_lines(V_Function* function){
+    int* lines = malloc(sizeof(int) * function->length);
+    for (int i = 0; i < function->length; i++) lines[i] = LINE_UNSEEN;
+    lines[0] = -1;
+
+    bool changed = TRUE;
+    while (changed){
+        changed = FALSE;
+        for (int i = 0; i < function->length; i++){
+            if (lines[i] == LINE_UNSEEN) continue;
+            u_int8_t* inst = function->instructions[i];
+            int line = inst[0] == NEW_LINE ? int_from_2_bytes(inst[1], inst[2]) : lines[i];
+
+            switch (inst[0]) {
+                case GOTO:
+                    changed |= merge_line(lines, int_from_2_bytes(inst[1], inst[2]), line);
+                    break;
+
+                case BRANCH_ZERO:
+                case BRANCH_NOT_ZERO:
+                    changed |= merge_line(lines, int_from_2_bytes(inst[1], inst[2]), line);
+                    changed |= merge_line(lines, i + 1, line);
+                    break;
+
+                case TABLESWITCH:
+                case LOOKUPSWITCH:
+                    for (int k = -1; k < switch_count(inst); k++)
+                        changed |= merge_line(lines, switch_target(inst, k), line);
+                    break;
+
+                case RETURN:
+                case THROW:
+                    break;
+
+                default:
+                    changed |= merge_line(lines, i + 1, line);
+            }
+
+            for (int h = 0; h < function->handler_count; h++){
+                Handler* handler = &function->handlers[h];
+                if (i >= handler->start && i < handler->end)
+                    changed |= merge_line(lines, handler->target, lines[i]);
+            }
+        }
+    }
+    return lines;
+}
+
+/* small callees that are not decoded yet are decoded here, larger ones are left alone */
+V_Function* inline_candidate(Loaded* loaded, V_Function* caller, u_int8_t* inst){
+    if (inst[0] != INVOKE_VIRTUAL) return NULL;
+    V_Function* callee = loaded->pool->values[inst[1]];
+    if (callee == caller) return NULL;
+
+    if (callee->instructions == NULL){
+        int size = callee->raw_size != 0 ? callee->raw_size : callee->code_size;
+        if (size > INLINE_MAX_BODY_SIZE) return NULL;
+        prepare_function(loaded, callee);
+    }
+    return is_inlinable(callee) && inlined_length(callee) > 0 ? callee : NULL;
+}
+
+u_int8_t* copy_instruction(u_int8_t* inst, int locals_base){
+    int length = inst[0] == PUSH_CONST ? (int) sizeof(Quick_Inst) : instruction_length(inst);
+    u_int8_t* copy = malloc(length);
+    memcpy(copy, inst, length);
+    if (copy[0] == LOAD_LOCAl || copy[0] == STORE_LOCAL)
+        copy[1] += locals_base;
+    return copy;
+}
+
+void remap_target(u_int8_t* at, int* map){
+    int target = map[(at[0] << 8) | at[1]];
+    at[0] = (target >> 8) & 0xFF;
+    at[1] = target & 0xFF;
+}
+
+void remap_branches(u_int8_t* inst, int* map){
+    switch (inst[0]) {
+        case GOTO:
+        case BRANCH_ZERO:
+        case BRANCH_NOT_ZERO:
+            remap_target(inst + 1, map);
+            break;
+
+        case TABLESWITCH:
+            remap_target(inst + 1, map);
+            for (int i = 0; i < inst[7]; i++)
+                remap_target(inst + 8 + 2*i, map);
+            break;
+
+        case LOOKUPSWITCH:
+            remap_target(inst + 1, map);
+            for (int i = 0; i < inst[3]; i++)
+                remap_target(inst + 8 + 6*i, map);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void inline_calls(Loaded* loaded, V_Function* function){
+    if (!inline_enabled() || !function->verified) return;
+
+    int length = function->length;
+    V_Function** callees = calloc(length, sizeof(V_Function*));
+    int* map = malloc(sizeof(int) * (length + 1));
+    int new_length = 0;
+    int extra_locals = 0;
+    int inlined = 0;
+    int* lines = NULL;
+
+    for (int i = 0; i < length; i++){
+        map[i] = new_length;
+        callees[i] = inline_candidate(loaded, function, function->instructions[i]);
+
+        /* a callee that sets lines is only inlined where the caller's line can be restored after it */
+        if (callees[i] != NULL && sets_line(callees[i])){
+            if (lines == NULL) lines = caller_lines(function);
+            if (lines[i] < 0) callees[i] = NULL;
+        }
+        if (callees[i] == NULL){
+            new_length++;
+            continue;
+        }
+        new_length += inlined_length(callees[i]);
+        inlined++;
+        if (callees[i]->locals > extra_locals)
+            extra_locals = callees[i]->locals;
+    }
+    map[length] = new_length;
+
+    /* callees share one range of locals as their bodies never overlap */
+    if (inlined == 0 || function->locals + extra_locals > 255 || new_length > MAX_FUNCTION_LENGTH){
+        free(callees);
+        free(map);
+        free(lines);
+        return;
+    }
+
+    bool report = inline_report();
+    u_int8_t** instructions = malloc(sizeof(u_int8_t*) * new_length);
+    int n = 0;
+    for (int i = 0; i < length; i++){
+        u_int8_t* inst = function->instructions[i];
+        V_Function* callee = callees[i];
+        if (callee == NULL){
+            remap_branches(inst, map);
+            instructions[n++] = inst;
+            continue;
+        }
+
+        if (report)
+            fprintf(stderr, "inlined %s into %s at instruction %d\n", callee->name, function->name, i);
+        for (int j = 0; j < callee->length - 1; j++)
+            instructions[n++] = copy_instruction(callee->instructions[j], function->locals);
+        if (sets_line(callee)){
+            u_int8_t* restore = malloc(3);
+            restore[0] = NEW_LINE;
+            restore[1] = (lines[i] >> 8) & 0xFF;
+            restore[2] = lines[i] & 0xFF;
+            instructions[n++] = restore;
+        }
+        free(inst);
+    }
+
+    for (int i = 0; i < function->handler_count; i++){
+        Handler* handler = &function->handlers[i];
+        handler->start = map[handler->start];
+        handler->end = map[handler->end];
+        handler->target = map[handler->target];
+    }
+
+    free(function->instructions);
+    function->instructions = instructions;
+    function->length = n;
+    function->locals += extra_locals;
+    free(callees);
+    free(map);
+    free(lines);
+
+    /* recomputes the operand stack size for the new body */
+    function->verified = FALSE;
+    verify_function(loaded->pool, function);
+}
+
+void inline_all(Loaded* loaded){
+    Pool* pool = loaded->pool;
+    for (int i = 0; i < pool->size; i++){
+        if (pool->tags[i] == 3)
+            inline_calls(loaded, pool->values[i]);
+    }
+}
@@ -0,0 +1,21 @@
+#include <stdlib.h>
+
+/*
+ * Load-time inliner. An INVOKE_VIRTUAL of a small straight-line function is
+ * replaced by the callee's body: its locals are moved behind the caller's,
+ * its final RETURN is dropped and the caller's branch targets and handler
+ * ranges are remapped. The callee's NEW_LINEs are kept and followed by one
+ * restoring the caller's line, so a callee that sets lines is only inlined
+ * where the caller's line is the same on every path to the call.
+ * Set RABBIT_INLINE=0 to disable it and RABBIT_INLINE_REPORT=1 to list every
+ * inlined call on stderr.
+ */
+struct loaded;
+struct v_function;
+
+/* rewrites the branch targets of 'inst' from old to new instruction indices */
+void remap_branches(u_int8_t* inst, int* map);
+
+void inline_calls(struct loaded* loaded, struct v_function* function);
+
+void inline_all(struct loaded* loaded);
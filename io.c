@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "utils.h"
+#include "io.h"
+
+#define READ_BUFFER_SIZE 65536
+#define WRITE_BUFFER_SIZE 65536
+
+static Stream* std_in = NULL;
+static Stream* std_out = NULL;
+
+
+Stream* new_stream(){
+    Stream* stream = malloc(sizeof(Stream));
+    note_allocation(sizeof(Stream));
+    stream->out = NULL;
+    stream->fd = -1;
+    stream->data = NULL;
+    stream->size = 0;
+    stream->pos = 0;
+    stream->capacity = 0;
+    stream->mapped = FALSE;
+    stream->eof = FALSE;
+    stream->view.chars = NULL;
+    stream->view.length = 0;
+    stream->view.allocated = FALSE;
+    return stream;
+}
+
+Stream* open_input(int fd){
+    Stream* stream = new_stream();
+    stream->fd = fd;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)){
+        stream->mapped = TRUE;
+        stream->eof = TRUE;
+        stream->size = info.st_size;
+        if (info.st_size > 0){
+            stream->data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (stream->data == MAP_FAILED){
+                close(fd);
+                free(stream);
+                return NULL;
+            }
+            madvise(stream->data, info.st_size, MADV_SEQUENTIAL);
+        }
+        return stream;
+    }
+
+    stream->capacity = READ_BUFFER_SIZE;
+    stream->data = malloc(stream->capacity);
+    note_allocation(stream->capacity);
+    return stream;
+}
+
+Stream* open_output(FILE* out){
+    Stream* stream = new_stream();
+    stream->out = out;
+    setvbuf(out, NULL, _IOFBF, WRITE_BUFFER_SIZE);
+    return stream;
+}
+
+/* mode is "r", "w" or "a"; returns NULL if the file can not be opened */
+Stream* stream_open(char* path, char* mode){
+    if (strcmp(mode, "r") == 0){
+        int fd = open(path, O_RDONLY);
+        return fd == -1 ? NULL : open_input(fd);
+    }
+    if (strcmp(mode, "w") != 0 && strcmp(mode, "a") != 0)
+        return NULL;
+
+    FILE* out = fopen(path, mode);
+    return out == NULL ? NULL : open_output(out);
+}
+
+Stream* stream_stdin(){
+    if (std_in == NULL) std_in = open_input(0);
+    return std_in;
+}
+
+void stream_detach_stdin(){
+    int fd = open("/dev/null", O_RDONLY);
+    if (fd != -1){
+        dup2(fd, 0);
+        close(fd);
+    }
+    if (std_in != NULL){
+        std_in->pos = std_in->size;
+        std_in->eof = TRUE;
+    }
+}
+
+/* shares stdout's stdio buffer with println, so output stays in order */
+Stream* stream_stdout(){
+    if (std_out == NULL){
+        std_out = new_stream();
+        std_out->out = stdout;
+    }
+    return std_out;
+}
+
+/* reads more input into the buffer, keeping the unread bytes; returns FALSE at end of input */
+bool fill(Stream* stream){
+    if (stream->eof) return FALSE;
+
+    if (stream->pos > 0){
+        memmove(stream->data, stream->data + stream->pos, stream->size - stream->pos);
+        stream->size -= stream->pos;
+        stream->pos = 0;
+    }
+    if (stream->size == stream->capacity){
+        note_allocation(stream->capacity);
+        stream->capacity *= 2;
+        stream->data = realloc(stream->data, stream->capacity);
+    }
+
+    long count = read(stream->fd, stream->data + stream->size, stream->capacity - stream->size);
+    if (count <= 0){
+        stream->eof = TRUE;
+        return FALSE;
+    }
+    stream->size += count;
+    return TRUE;
+}
+
+View* take(Stream* stream, long length, long skip){
+    stream->view.chars = stream->data + stream->pos;
+    stream->view.length = length;
+    stream->pos += length + skip;
+    return &stream->view;
+}
+
+/* returns the next line without its line terminator, or NULL at end of input */
+View* stream_read_line(Stream* stream){
+    if (stream->fd == -1) return NULL;
+
+    long scanned = 0;
+    while (TRUE){
+        char* start = stream->data + stream->pos;
+        long available = stream->size - stream->pos;
+        char* newline = memchr(start + scanned, '\n', available - scanned);
+
+        if (newline != NULL){
+            long length = newline - start;
+            View* line = take(stream, length, 1);
+            if (length > 0 && line->chars[length - 1] == '\r')
+                line->length--;
+            return line;
+        }
+
+        scanned = available;
+        if (!fill(stream)){
+            if (stream->pos == stream->size) return NULL;
+            return take(stream, stream->size - stream->pos, 0);
+        }
+    }
+}
+
+/* returns up to 'length' bytes, or NULL at end of input */
+View* stream_read_chunk(Stream* stream, long length){
+    if (stream->fd == -1 || length <= 0) return NULL;
+
+    while (stream->size - stream->pos < length && fill(stream));
+    long available = stream->size - stream->pos;
+    if (available == 0) return NULL;
+    return take(stream, available < length ? available : length, 0);
+}
+
+View* stream_read_all(Stream* stream){
+    if (stream->fd == -1) return NULL;
+
+    while (fill(stream));
+    return take(stream, stream->size - stream->pos, 0);
+}
+
+void stream_write(Stream* stream, const char* chars, long length){
+    if (stream->out != NULL)
+        fwrite(chars, 1, length, stream->out);
+}
+
+void stream_flush(Stream* stream){
+    if (stream->out != NULL)
+        fflush(stream->out);
+}
+
+void stream_close(Stream* stream){
+    if (stream == std_in || stream == std_out){
+        stream_flush(stream);
+        return;
+    }
+
+    if (stream->out != NULL)
+        fclose(stream->out);
+    if (stream->mapped && stream->data != NULL)
+        munmap(stream->data, stream->size);
+    else
+        free(stream->data);
+    if (stream->fd != -1)
+        close(stream->fd);
+    free(stream);
+}
+
+View* view_new(char* chars, long length){
+    View* view = malloc(sizeof(View));
+    note_allocation(sizeof(View));
+    view->chars = chars;
+    view->length = length;
+    view->allocated = TRUE;
+    return view;
+}
+
+/* the view a stream hands out belongs to the stream */
+void view_free(View* view){
+    if (view->allocated)
+        free(view);
+}
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * File and stream I/O for the io_* and view_* natives. Regular files opened
+ * for reading are mmapped and every read hands out a View into the mapping,
+ * so lines and chunks are never copied. Other inputs (stdin, pipes) are read
+ * into a buffer owned by the stream. Either way a view returned by a read is
+ * reused by the next read of the same stream and its bytes are only valid until
+ * then. view_slice does not copy either: the slice must be released with
+ * view_free and is valid only as long as the bytes it was cut from, while
+ * view_string copies them into a string. Writes go through a large stdio buffer.
+ *
+ * io_open returns null if the file can not be opened; passing null on to the
+ * other natives raises a NullPointerError.
+ */
+typedef struct view {
+    char* chars;
+    long length;
+    /* set for views made by view_new, the ones view_free releases */
+    int allocated;
+} View;
+
+typedef struct stream {
+    FILE* out;
+    int fd;
+    char* data;
+    long size;
+    long pos;
+    long capacity;
+    int mapped;
+    int eof;
+    View view;
+} Stream;
+
+Stream* stream_open(char* path, char* mode);
+
+Stream* stream_stdin();
+
+/* in a forked child: drops what the parent buffered and reads stdin from /dev/null */
+void stream_detach_stdin();
+
+Stream* stream_stdout();
+
+View* stream_read_line(Stream* stream);
+
+View* stream_read_chunk(Stream* stream, long length);
+
+View* stream_read_all(Stream* stream);
+
+void stream_write(Stream* stream, const char* chars, long length);
+
+void stream_flush(Stream* stream);
+
+void stream_close(Stream* stream);
+
+View* view_new(char* chars, long length);
+
+void view_free(View* view);
@@ -4,9 +4,15 @@
 #include "utils.h"
 #include "pool.h"
 #include "env.h"
+#include "verify.h"
+#include "lz4.h"
+#include "inline.h"
+#include "opt.h"
+#include "parallel.h"
+#include "debug.h"
 #include "string.h"
 
-void read_file(char* file_name, u_int8_t** content, int* cursor){
+void read_file(char* file_name, u_int8_t** content, int* cursor, int* size){
     FILE *fileptr;
     u_int8_t *buffer;
     long filelen;
@@ -26,6 +32,7 @@ void read_file(char* file_name, u_int8_t** content, int* cursor){
 
     *content = buffer;
     *cursor = 0;
+    *size = (int) filelen;
 }
 
 void check_magic(u_int8_t** content_ptr, int* cursor){
@@ -40,25 +47,63 @@ void check_magic(u_int8_t** content_ptr, int* cursor){
 }
 
 
+#define IMAGE_COMPRESSED 0x01
+#define MAX_BLOCK_SIZE (1 << 28)
+
 typedef struct loaded {
     int main_addr;
+    int minor;
     Pool* pool;
+    u_int8_t* image;
+    struct debugger* debugger;
 } Loaded;
 
 
-Loaded* init_loaded_struct(int main_addr, Pool* pool){
+Loaded* init_loaded_struct(int main_addr, int minor, Pool* pool, u_int8_t* image){
     Loaded* loaded = malloc(sizeof(Loaded));
     loaded->main_addr = main_addr;
+    loaded->minor = minor;
     loaded->pool = pool;
+    loaded->image = image;
+    loaded->debugger = NULL;
     return loaded;
 }
 
-u_int8_t** load_instructions(u_int8_t** content, int* cursor){
+/*
+ * Bodies of a lazy image are decoded while the program runs, so a corrupt body
+ * fails the run the way the verifier does instead of exiting like a bad header.
+ */
+void corrupt_body(char* msg){
+    fprintf(stderr, "%s", msg);
+    exit(-1);
+}
+
+/* 'inst' points at the cmd_size bytes of an encoded instruction */
+void check_instruction(u_int8_t* inst, int cmd_size){
+    if (cmd_size == 0 || opcode_length(inst[0]) == -1)
+        corrupt_body("unsupported opcode");
+    if (cmd_size < opcode_length(inst[0]) || cmd_size < instruction_length(inst))
+        corrupt_body("truncated instruction");
+}
+
+/* 'limit' is the offset the body ends at, no byte at or past it is read */
+u_int8_t** load_instructions(u_int8_t** content, int* cursor, int limit, int* length){
+    if (limit - *cursor < 4)
+        corrupt_body("function body out of bounds");
     int instruction_amount = load_int(content, cursor);
+    if (instruction_amount < 0 || instruction_amount > limit - *cursor)
+        corrupt_body("function body out of bounds");
+    *length = instruction_amount;
     u_int8_t** instructions = malloc(sizeof(u_int8_t*) * instruction_amount);
 
     for (int i = 0; i < instruction_amount; i++){
+        if (*cursor >= limit)
+            corrupt_body("function body out of bounds");
         u_int8_t cmd_size = consume(content, cursor);
+        if (cmd_size > limit - *cursor)
+            corrupt_body("function body out of bounds");
+        check_instruction(*content + *cursor, cmd_size);
+
         u_int8_t* instruction = malloc(sizeof(u_int8_t) * cmd_size);
         for (int j = 0; j < cmd_size; j++){
             instruction[j] = consume(content, cursor);
@@ -69,25 +114,99 @@ u_int8_t** load_instructions(u_int8_t** content, int* cursor){
     return instructions;
 }
 
-void put_pool(char* name, void* putted, Pool* pool, u_int8_t tag){
+void put_pool(char* name, void* putted, Pool* pool, u_int8_t tag, bool* resolved){
     int pool_size = pool->size;
 
     for (int i = 0; i < pool_size; i++){
         u_int8_t curr_tag = pool->tags[i];
 
-        if(curr_tag == tag){
+        if(curr_tag == tag && !resolved[i]){
             char* curr_pool_val = pool->values[i];
 
             if (strcmp(curr_pool_val, name) == 0){
                 free(curr_pool_val);
                 pool->values[i] = putted;
+                resolved[i] = TRUE;
                 break;
             }
         }
     }
 }
 
-void load_functions(Pool* pool, u_int8_t** content, int* cursor){
+/* every function and struct entry of the pool must have been replaced by its definition */
+void check_resolved(Pool* pool, bool* resolved){
+    for (int i = 0; i < pool->size; i++){
+        u_int8_t tag = pool->tags[i];
+        if ((tag == 3 || tag == 5) && !resolved[i]){
+            fprintf(stderr, "%s%s%s", "unresolved constant-pool entry '", (char*) pool->values[i], "'");
+            exit(-1);
+        }
+    }
+}
+
+/* the eager layout has no directory, so a body is located by stepping over its instructions */
+int skip_instructions(u_int8_t** content, int* cursor, int image_size){
+    int start = *cursor;
+    if (image_size - *cursor < 4)
+        corrupt_body("function body out of image bounds");
+
+    int amount = load_int(content, cursor);
+    for (int i = 0; i < amount; i++){
+        if (*cursor >= image_size)
+            corrupt_body("function body out of image bounds");
+        int cmd_size = consume(content, cursor);
+        if (cmd_size > image_size - *cursor)
+            corrupt_body("function body out of image bounds");
+        check_instruction(*content + *cursor, cmd_size);
+        *cursor += cmd_size;
+    }
+    return *cursor - start;
+}
+
+void decode_body(void* functions, int i){
+    V_Function* function = ((V_Function**) functions)[i];
+    int cursor = 0;
+    function->instructions = load_instructions(&function->code, &cursor, function->code_size, &function->length);
+    function->code = NULL;
+    function->code_size = 0;
+}
+
+void load_functions(Pool* pool, u_int8_t** content, int* cursor, int image_size, bool* resolved){
+    u_int8_t amount = consume(content, cursor);
+    V_Function** functions = malloc(sizeof(V_Function*) * amount);
+
+    for (int i = 0; i < amount; i++){
+        V_Function* function = malloc(sizeof(V_Function));
+
+        function->name = load_string(content, cursor);
+        function->op_stack = consume(content, cursor);
+        function->locals = consume(content, cursor);
+        function->code = *content + *cursor;
+        function->code_size = skip_instructions(content, cursor, image_size);
+        function->instructions = NULL;
+        function->length = 0;
+        function->raw_size = 0;
+        function->arity = -1;
+        function->verified = FALSE;
+        function->handler_count = 0;
+        function->handlers = NULL;
+
+        functions[i] = function;
+        put_pool(function->name, function, pool, 3, resolved);
+    }
+
+    /* every body was checked while locating it, so decoding can not fail and runs in parallel */
+    parallel_for(amount, decode_body, functions);
+    free(functions);
+}
+
+/*
+ * Directory layout (minor version 2): every function is described by its name,
+ * frame sizes and the offset/size of its body in the image. Bodies are decoded
+ * by prepare_function the first time the function is invoked. In a compressed
+ * image the size is followed by the size of the decompressed body.
+ */
+void load_function_directory(Pool* pool, u_int8_t** content, int* cursor, int image_size, bool compressed, bool* resolved){
     u_int8_t amount = consume(content, cursor);
 
     for (int i = 0; i < amount; i++){
@@ -96,19 +215,157 @@ void load_functions(Pool* pool, u_int8_t** content, int* cursor){
         function->name = load_string(content, cursor);
         function->op_stack = consume(content, cursor);
         function->locals = consume(content, cursor);
-        function->instructions = load_instructions(content, cursor);
 
-        put_pool(function->name, function, pool, 3);
+        int offset = load_int(content, cursor);
+        int size = load_int(content, cursor);
+        if (offset < 0 || size < 4 || offset > image_size - size)
+            corrupt_body("function body out of image bounds");
+
+        function->code = *content + offset;
+        function->code_size = size;
+        function->raw_size = 0;
+        if (compressed){
+            function->raw_size = load_int(content, cursor);
+            if (function->raw_size < 4 || function->raw_size > MAX_BLOCK_SIZE)
+                corrupt_body("invalid decompressed function body size");
+        }
+        function->instructions = NULL;
+        function->length = 0;
+        function->arity = -1;
+        function->verified = FALSE;
+        function->handler_count = 0;
+        function->handlers = NULL;
+
+        put_pool(function->name, function, pool, 3, resolved);
+    }
+}
+
+/*
+ * Since minor version 3 a body ends with its exception table: a count byte,
+ * then per handler the covered range start..end-1, the handler address
+ * (two bytes each) and the pool index of the caught type, 0xFF catching all.
+ */
+void load_handlers(Pool* pool, V_Function* function, u_int8_t** content, int* cursor, int limit){
+    if (*cursor >= limit)
+        corrupt_body("function body out of bounds");
+    function->handler_count = consume(content, cursor);
+    if (7 * function->handler_count > limit - *cursor)
+        corrupt_body("function body out of bounds");
+    function->handlers = malloc(sizeof(Handler) * function->handler_count);
+
+    for (int i = 0; i < function->handler_count; i++){
+        Handler* handler = &function->handlers[i];
+        handler->start = load_short(content, cursor);
+        handler->end = load_short(content, cursor);
+        handler->target = load_short(content, cursor);
+
+        u_int8_t type_addr = consume(content, cursor);
+        if (type_addr == 0xFF)
+            handler->type = NULL;
+        else if (type_addr < pool->size && pool->tags[type_addr] == 5)
+            handler->type = pool->values[type_addr];
+        else
+            corrupt_body("exception handler does not refer to a struct type");
     }
 }
 
-void load_structs(Pool* pool, u_int8_t** content, int* cursor){
+u_int8_t* decompress_block(u_int8_t* block, int size, int raw_size){
+    u_int8_t* raw = malloc(raw_size);
+    if (lz4_decompress(block, size, raw, raw_size) != raw_size)
+        corrupt_body("corrupt compressed block");
+    return raw;
+}
+
+void prepare_function(Loaded* loaded, V_Function* function){
+    if (function->instructions != NULL) return;
+
+    /* compressed bodies are inflated one function at a time and dropped once decoded */
+    u_int8_t* code = function->code;
+    int code_size = function->code_size;
+    if (function->raw_size != 0){
+        code = decompress_block(function->code, function->code_size, function->raw_size);
+        code_size = function->raw_size;
+    }
+
+    int cursor = 0;
+    function->instructions = load_instructions(&code, &cursor, code_size, &function->length);
+    if (loaded->minor >= 3)
+        load_handlers(loaded->pool, function, &code, &cursor, code_size);
+    if (cursor != code_size)
+        corrupt_body("function body size does not match its directory entry");
+    if (code != function->code)
+        free(code);
+    verify_function(loaded->pool, function);
+    inline_calls(loaded, function);
+    optimize_function(loaded, function);
+    if (loaded->debugger != NULL)
+        debug_prepared(loaded->debugger, function);
+}
+
+/* a compressed pool is stored as its decompressed size, its compressed size and the LZ4 block */
+Pool* load_compressed_pool(u_int8_t** content, int* cursor, int image_size){
+    int raw_size = load_int(content, cursor);
+    int size = load_int(content, cursor);
+    if (raw_size < 1 || raw_size > MAX_BLOCK_SIZE || size < 0 || size > image_size - *cursor)
+        error("invalid compressed pool size");
+
+    u_int8_t* raw = decompress_block(*content + *cursor, size, raw_size);
+    *cursor += size;
+
+    int raw_cursor = 0;
+    Pool* pool = load_pool(&raw, &raw_cursor);
+    if (raw_cursor != raw_size)
+        error("pool size does not match its header");
+    free(raw);
+    return pool;
+}
+
+int field_width(u_int8_t kind){
+    switch (kind) {
+        case FIELD_I8: return 1;
+        case FIELD_I32:
+        case FIELD_F32: return 4;
+        default: return sizeof(void*);
+    }
+}
+
+/*
+ * Since minor version 5 the field count is followed by one kind byte per
+ * field. Fields are laid out widest first so that every field is naturally
+ * aligned without padding between them.
+ */
+void load_field_layout(Type* type, u_int8_t** content, int* cursor){
+    type->kinds = malloc(type->size > 0 ? type->size : 1);
+    type->offsets = malloc(sizeof(u_int16_t) * (type->size > 0 ? type->size : 1));
+    for (int i = 0; i < type->size; i++){
+        type->kinds[i] = consume(content, cursor);
+        if (type->kinds[i] > FIELD_F32)
+            error("unsupported field kind");
+    }
+
+    int offset = 0;
+    for (int width = sizeof(void*); width >= 1; width /= 2){
+        for (int i = 0; i < type->size; i++){
+            if (field_width(type->kinds[i]) != width) continue;
+            type->offsets[i] = offset;
+            offset += width;
+        }
+    }
+    type->bytes = (offset + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+}
+
+void load_structs(Pool* pool, u_int8_t** content, int* cursor, bool packed, bool* resolved){
     u_int8_t amount = consume(content, cursor);
     for (int i = 0; i < amount; i++){
         Type* type = malloc(sizeof(Type));
 
         type->name = load_string(content, cursor);
         type->size = consume(content, cursor);
+        type->kinds = NULL;
+        type->offsets = NULL;
+        type->bytes = sizeof(void*) * type->size;
+        if (packed)
+            load_field_layout(type, content, cursor);
 
         u_int8_t method_cnt = consume(content, cursor);
 
@@ -132,30 +389,58 @@ void load_structs(Pool* pool, u_int8_t** content, int* cursor){
         }
 
 
-        put_pool(type->name, type, pool, 5);
+        put_pool(type->name, type, pool, 5, resolved);
     }
 }
 
 Loaded* load(char* file_name){
     u_int8_t* content;
     int cursor;
-    read_file(file_name, &content, &cursor);
+    int size;
+    read_file(file_name, &content, &cursor, &size);
     check_magic(&content, &cursor);
 
     int major = load_int(&content, &cursor);
     int minor = load_int(&content, &cursor);
 
     if (minor < 1) error("unsupported minor version");
-    if (major > 1) error("unsupported minor version");
+    if (major > 1) error("unsupported major version");
+    if (minor > 5) error("unsupported minor version");
+
+    /* since minor version 4 the header carries a flags byte */
+    int flags = minor >= 4 ? content[cursor++] : 0;
+    if ((flags & ~IMAGE_COMPRESSED) != 0) error("unsupported image flags");
+    bool compressed = (flags & IMAGE_COMPRESSED) != 0;
 
     int main_addr = content[cursor++];
 
-    Pool* pool = load_pool(&content, &cursor);
-    load_functions(pool, &content, &cursor);
-    load_structs(pool, &content, &cursor);
+    Pool* pool = compressed ? load_compressed_pool(&content, &cursor, size) : load_pool(&content, &cursor);
+    bool* resolved = calloc(pool->size, sizeof(bool));
+
+    if (minor >= 2){
+        /* function bodies stay in the image until they are first invoked */
+        load_function_directory(pool, &content, &cursor, size, compressed, resolved);
+        load_structs(pool, &content, &cursor, minor >= 5, resolved);
+        check_resolved(pool, resolved);
+        free(resolved);
+
+        if (main_addr >= pool->size || pool->tags[main_addr] != 3)
+            error("main address does not refer to a function");
+        ((V_Function*) pool->values[main_addr])->arity = 0;
+        return init_loaded_struct(main_addr, minor, pool, content);
+    }
+
+    load_functions(pool, &content, &cursor, size, resolved);
+    load_structs(pool, &content, &cursor, FALSE, resolved);
+    check_resolved(pool, resolved);
+    free(resolved);
+    verify_reachable(pool, main_addr);
 
     free(content);
-    return init_loaded_struct(main_addr, pool);
+    Loaded* loaded = init_loaded_struct(main_addr, minor, pool, NULL);
+    inline_all(loaded);
+    optimize_all(loaded);
+    return loaded;
 }
 
 
@@ -163,7 +448,6 @@ void free_pool(Pool* pool){
     for (int i = 0; i < pool->size; ++i) {
         u_int8_t tag = pool->tags[i];
         switch (tag) {
-            case 2:
             case 4:
             case 6:
                 free(pool->values[i]);
@@ -173,7 +457,11 @@ void free_pool(Pool* pool){
             {
                 V_Function* func = pool->values[i];
                 free(func->name);
+                for (int j = 0; j < func->length; ++j) {
+                    free(func->instructions[j]);
+                }
                 free(func->instructions);
+                free(func->handlers);
                 free(func);
             }
                 break;
@@ -182,11 +470,16 @@ void free_pool(Pool* pool){
             {
                 Type* type = pool->values[i];
                 free(type->name);
-                for (int j = 0; j < type->v_methods->size; ++j) {
-                    free(type->v_methods->names[i]);
+                if (type->v_methods != NULL) {
+                    for (int j = 0; j < type->v_methods->size; ++j) {
+                        free(type->v_methods->names[j]);
+                    }
+                    free(type->v_methods->names);
+                    free(type->v_methods->addresses);
+                    free(type->v_methods);
                 }
-                free(type->v_methods->addresses);
-                free(type->v_methods);
+                free(type->kinds);
+                free(type->offsets);
                 free(type);
             }
                 break;
@@ -195,5 +488,8 @@ void free_pool(Pool* pool){
                 break;
         }
     }
+    free(pool->tags);
+    free(pool->values);
+    free(pool);
 }
 
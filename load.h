@@ -1,10 +1,17 @@
 #include "pool.h"
 
+struct v_function;
+
 typedef struct loaded {
     int main_addr;
+    int minor;
     Pool* pool;
+    u_int8_t* image;
+    struct debugger* debugger;
 } Loaded;
 
 Loaded* load(char* file_name);
 
+void prepare_function(Loaded* loaded, struct v_function* function);
+
 void free_pool(Pool* pool);
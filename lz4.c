@@ -0,0 +1,52 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lz4.h"
+
+/* reads the extension bytes of a 4-bit length field, -1 if 'src' ends first */
+long read_length(const u_int8_t** src, const u_int8_t* end, long length){
+    if (length != 15) return length;
+    u_int8_t byte;
+    do {
+        if (*src >= end) return -1;
+        byte = *(*src)++;
+        length += byte;
+    } while (byte == 255);
+    return length;
+}
+
+int lz4_decompress(const u_int8_t* src, int src_size, u_int8_t* dst, int dst_capacity){
+    const u_int8_t* in = src;
+    const u_int8_t* in_end = src + src_size;
+    u_int8_t* out = dst;
+    u_int8_t* out_end = dst + dst_capacity;
+
+    while (in < in_end){
+        u_int8_t token = *in++;
+
+        long literals = read_length(&in, in_end, token >> 4);
+        if (literals < 0 || literals > in_end - in || literals > out_end - out)
+            return -1;
+        memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+
+        /* the last sequence has no match part */
+        if (in == in_end) break;
+
+        if (in_end - in < 2) return -1;
+        long offset = in[0] | (in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > out - dst) return -1;
+
+        long match = read_length(&in, in_end, token & 0x0F);
+        if (match < 0) return -1;
+        match += 4;
+        if (match > out_end - out) return -1;
+
+        /* byte by byte, as the match may overlap what it produces */
+        u_int8_t* from = out - offset;
+        for (long i = 0; i < match; i++)
+            *out++ = *from++;
+    }
+    return (int)(out - dst);
+}
@@ -0,0 +1,8 @@
+#include <stdlib.h>
+
+/*
+ * Decoder for the LZ4 block format, used for compressed images. Returns the
+ * number of bytes written to 'dst', or -1 if the block is malformed or does
+ * not fit into 'dst_capacity' bytes.
+ */
+int lz4_decompress(const u_int8_t* src, int src_size, u_int8_t* dst, int dst_capacity);
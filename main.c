@@ -1,5 +1,19 @@
 #include "thread.h"
+#include "zygote.h"
+
+long budget_from_env(char* name){
+    char* value = getenv(name);
+    return value == NULL ? 0 : atol(value);
+}
 
 int main() {
-    return exec("test.rbtc");
+    Budget budget;
+    budget.instructions = budget_from_env("RABBIT_MAX_INSTRUCTIONS");
+    budget.time_ms = budget_from_env("RABBIT_MAX_TIME_MS");
+    budget.memory = budget_from_env("RABBIT_MAX_MEMORY");
+
+    char* entry = getenv("RABBIT_ZYGOTE_ENTRY");
+    if (entry != NULL)
+        return serve("test.rbtc", &budget, getenv("RABBIT_ZYGOTE_INIT"), entry);
+    return exec_with_budget("test.rbtc", &budget);
 }
@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "map.h"
+
+#define EMPTY 0
+#define FULL 1
+#define DELETED 2
+
+#define MIN_CAPACITY 8
+#define MIGRATE_STEP 8
+
+
+unsigned long hash_word(void* key){
+    unsigned long h = (unsigned long) key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53UL;
+    h ^= h >> 33;
+    return h;
+}
+
+void init_table(Map_Table* table, int capacity){
+    table->capacity = capacity;
+    table->used = 0;
+    table->states = calloc(capacity, sizeof(u_int8_t));
+    table->entries = malloc(sizeof(Map_Entry) * capacity);
+    note_allocation((sizeof(u_int8_t) + sizeof(Map_Entry)) * capacity);
+}
+
+void release_table(Map_Table* table){
+    free(table->states);
+    free(table->entries);
+    table->states = NULL;
+    table->entries = NULL;
+    table->capacity = 0;
+    table->used = 0;
+}
+
+int find_slot(Map_Table* table, void* key){
+    if (table->capacity == 0) return -1;
+    int mask = table->capacity - 1;
+    int idx = (int)(hash_word(key) & mask);
+    while (table->states[idx] != EMPTY){
+        if (table->states[idx] == FULL && table->entries[idx].key == key)
+            return idx;
+        idx = (idx + 1) & mask;
+    }
+    return -1;
+}
+
+/* returns the slot holding 'key', or the first free slot of its probe sequence */
+int find_insert_slot(Map_Table* table, void* key){
+    int mask = table->capacity - 1;
+    int idx = (int)(hash_word(key) & mask);
+    int free_slot = -1;
+    while (table->states[idx] != EMPTY){
+        if (table->states[idx] == FULL && table->entries[idx].key == key)
+            return idx;
+        if (table->states[idx] == DELETED && free_slot == -1)
+            free_slot = idx;
+        idx = (idx + 1) & mask;
+    }
+    return free_slot == -1 ? idx : free_slot;
+}
+
+void table_insert(Map_Table* table, void* key, void* value){
+    int idx = find_insert_slot(table, key);
+    if (table->states[idx] == EMPTY) table->used++;
+    table->states[idx] = FULL;
+    table->entries[idx].key = key;
+    table->entries[idx].value = value;
+}
+
+int capacity_for(int size){
+    int capacity = MIN_CAPACITY;
+    while (capacity * 3 < size * 4) capacity *= 2;
+    return capacity;
+}
+
+
+Map* map_new(int capacity){
+    Map* map = malloc(sizeof(Map));
+    note_allocation(sizeof(Map));
+    map->size = 0;
+    map->migrated = 0;
+    map->pending = 0;
+    memset(&map->old, 0, sizeof(Map_Table));
+    init_table(&map->table, capacity_for(capacity));
+    return map;
+}
+
+void migrate(Map* map, int steps){
+    Map_Table* old = &map->old;
+    while (steps-- > 0 && map->migrated < old->capacity){
+        int idx = map->migrated++;
+        if (old->states[idx] == FULL){
+            table_insert(&map->table, old->entries[idx].key, old->entries[idx].value);
+            old->states[idx] = DELETED;
+            map->pending--;
+        }
+    }
+    if (map->migrated == old->capacity){
+        release_table(old);
+        map->pending = 0;
+    }
+}
+
+void grow(Map* map){
+    /* finish a pending resize before starting the next one */
+    if (map->old.entries != NULL)
+        migrate(map, map->old.capacity);
+
+    map->old = map->table;
+    map->migrated = 0;
+    map->pending = map->size;
+    init_table(&map->table, capacity_for(map->size * 2));
+}
+
+/*
+ * Entries still waiting in the old table count against the new one, so draining
+ * them can never push the table past its load factor.
+ */
+int needs_grow(Map* map){
+    return (map->table.used + map->pending + 1) * 4 > map->table.capacity * 3;
+}
+
+int map_get(Map* map, void* key, void** value){
+    int idx = find_slot(&map->table, key);
+    if (idx != -1){
+        *value = map->table.entries[idx].value;
+        return 1;
+    }
+    idx = find_slot(&map->old, key);
+    if (idx != -1){
+        *value = map->old.entries[idx].value;
+        return 1;
+    }
+    return 0;
+}
+
+void map_put(Map* map, void* key, void* value){
+    if (map->old.entries != NULL){
+        int old_idx = find_slot(&map->old, key);
+        if (old_idx != -1){
+            map->old.states[old_idx] = DELETED;
+            map->pending--;
+            map->size--;
+        }
+        migrate(map, MIGRATE_STEP);
+    }
+
+    int idx = find_slot(&map->table, key);
+    if (idx != -1){
+        map->table.entries[idx].value = value;
+        return;
+    }
+
+    if (needs_grow(map))
+        grow(map);
+    map->size++;
+    table_insert(&map->table, key, value);
+}
+
+int map_remove(Map* map, void* key){
+    int removed = 0;
+    int idx = find_slot(&map->table, key);
+    if (idx != -1){
+        map->table.states[idx] = DELETED;
+        removed = 1;
+    }
+    else {
+        idx = find_slot(&map->old, key);
+        if (idx != -1){
+            map->old.states[idx] = DELETED;
+            map->pending--;
+            removed = 1;
+        }
+    }
+    if (removed) map->size--;
+    if (map->old.entries != NULL)
+        migrate(map, MIGRATE_STEP);
+    return removed;
+}
+
+/*
+ * Cursors walk the slots of the draining table first and then the current one.
+ * Iteration is stable as long as the map is not written to.
+ */
+Map_Entry* entry_at(Map* map, int cursor){
+    if (cursor < 0 || cursor >= map->old.capacity + map->table.capacity)
+        return NULL;
+    if (cursor < map->old.capacity)
+        return map->old.states[cursor] == FULL ? &map->old.entries[cursor] : NULL;
+    cursor -= map->old.capacity;
+    return map->table.states[cursor] == FULL ? &map->table.entries[cursor] : NULL;
+}
+
+int map_next(Map* map, int cursor){
+    int end = map->old.capacity + map->table.capacity;
+    for (cursor++; cursor < end; cursor++){
+        if (entry_at(map, cursor) != NULL)
+            return cursor;
+    }
+    return -1;
+}
+
+void* map_key_at(Map* map, int cursor){
+    Map_Entry* entry = entry_at(map, cursor);
+    return entry == NULL ? NULL : entry->key;
+}
+
+void* map_value_at(Map* map, int cursor){
+    Map_Entry* entry = entry_at(map, cursor);
+    return entry == NULL ? NULL : entry->value;
+}
+
+void map_free(Map* map){
+    release_table(&map->table);
+    release_table(&map->old);
+    free(map);
+}
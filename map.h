@@ -0,0 +1,43 @@
+#include <stdlib.h>
+
+/*
+ * Open-addressing hash map keyed on VM words (ints and interned strings).
+ * Strings are keyed by identity, so runtime strings go through str_intern first.
+ * Growing the table is incremental: the previous table is drained a few
+ * slots per write, so no single put pays for rehashing the whole map.
+ */
+typedef struct map_entry {
+    void* key;
+    void* value;
+} Map_Entry;
+
+typedef struct map_table {
+    int capacity;
+    int used;
+    u_int8_t* states;
+    Map_Entry* entries;
+} Map_Table;
+
+typedef struct map {
+    int size;
+    Map_Table table;
+    Map_Table old;
+    int migrated;
+    int pending;
+} Map;
+
+Map* map_new(int capacity);
+
+int map_get(Map* map, void* key, void** value);
+
+void map_put(Map* map, void* key, void* value);
+
+int map_remove(Map* map, void* key);
+
+int map_next(Map* map, int cursor);
+
+void* map_key_at(Map* map, int cursor);
+
+void* map_value_at(Map* map, int cursor);
+
+void map_free(Map* map);
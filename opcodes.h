@@ -0,0 +1,145 @@
+#include <stdlib.h>
+
+enum Opcode {
+    PUSH_NULL,
+    PUSH_INT,
+    LOAD_CONST,
+
+    LOAD_LOCAl,
+    STORE_LOCAL,
+
+    NEW,
+    FREE,
+    NULL_CHECK,
+    CHECK_CAST,
+    I2F,
+    F2I,
+
+    MAKE_ARRAY,
+    READ_ARRAY,
+    WRITE_ARRAY,
+
+    GET_FIELD,
+    PUT_FIELD,
+
+    INVOKE_VIRTUAL,
+    INVOKE_TEMPLATE,
+    INVOKE_NATIVE,
+    RETURN,
+
+    DUP,
+    SWAP,
+    POP,
+
+    NOT,
+    NEG,
+
+    ADD_I,
+    SUB_I,
+    MUL_I,
+    MOD,
+    AND,
+    OR,
+    AND_BIT,
+    OR_BIT,
+    XOR,
+    SHIFT_AL,
+    SHIFT_AR,
+    ADD_F,
+    SUB_F,
+    MUL_F,
+    DIV,
+    EQUALS,
+    NOT_EQUALS,
+    LESS,
+    GREATER,
+    LESS_EQ,
+    GREATER_EQ,
+
+
+    GOTO,
+    BRANCH_NOT_ZERO,
+    BRANCH_ZERO,
+
+    NEW_LINE,
+
+    THROW,
+
+    PAR_MAP,
+    PAR_FILTER,
+    PAR_REDUCE,
+
+    /* opc, default (2 bytes), low (4 bytes), count, count targets (2 bytes each) */
+    TABLESWITCH,
+    /* opc, default (2 bytes), count, count pairs of key (4 bytes) and target (2 bytes), keys ascending */
+    LOOKUPSWITCH,
+
+    /* field access of packed struct types, the field must have the given kind */
+    GET_FIELD_I8,
+    GET_FIELD_I32,
+    GET_FIELD_F32,
+    PUT_FIELD_I8,
+    PUT_FIELD_I32,
+    PUT_FIELD_F32,
+
+    /* 64-bit integers and doubles, stored unboxed in a slot; the left operand is on top */
+    ADD_L,
+    SUB_L,
+    MUL_L,
+    DIV_L,
+    REM_L,
+    NEG_L,
+    AND_L,
+    OR_L,
+    XOR_L,
+    SHIFT_LL,
+    SHIFT_RL,
+    ADD_D,
+    SUB_D,
+    MUL_D,
+    DIV_D,
+    NEG_D,
+    /* push -1, 0 or 1; CMP_D treats NaN as greater */
+    CMP_L,
+    CMP_D,
+    I2L,
+    L2I,
+    I2D,
+    D2I,
+    L2D,
+    D2L,
+    F2D,
+    D2F,
+
+    /* quickened forms, never present in an image */
+    PUSH_CONST = 0xF0,
+    INVOKE_RESOLVED,
+    INVOKE_NATIVE_RESOLVED,
+    GET_FIELD_I8_RESOLVED,
+    GET_FIELD_I32_RESOLVED,
+    PUT_FIELD_I8_RESOLVED,
+    PUT_FIELD_I32_RESOLVED,
+
+    /* patched in by the debugger */
+    BREAKPOINT = 0xFF,
+};
+
+typedef struct quick_inst {
+    u_int8_t opcode;
+    u_int8_t argc;
+    void* operand;
+} Quick_Inst;
+
+/* a typed field access whose kind was checked for objects of 'type' */
+typedef struct field_inst {
+    u_int8_t opcode;
+    u_int8_t addr;
+    u_int8_t kind;
+    u_int16_t offset;
+    struct type* type;
+} Field_Inst;
+
+typedef struct breakpoint_inst {
+    u_int8_t opcode;
+    u_int8_t* original;
+} Breakpoint_Inst;
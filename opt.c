@@ -0,0 +1,731 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "utils.h"
+#include "load.h"
+#include "env.h"
+#include "opcodes.h"
+#include "verify.h"
+#include "inline.h"
+#include "opt.h"
+#include "parallel.h"
+
+#define MAX_LOCALS 256
+#define MAX_ROUNDS 4
+
+/* one bit per local variable */
+typedef struct locals_set {
+    u_int64_t bits[MAX_LOCALS / 64];
+} Locals_Set;
+
+typedef struct block {
+    int start;
+    int end;
+    int succ_count;
+    int* succs;
+    bool reachable;
+    Locals_Set live_in;
+} Block;
+
+typedef struct cfg {
+    int count;
+    Block* blocks;
+    int* block_of;
+    bool* leaders;
+} CFG;
+
+static char* opcode_names[] = {
+        [PUSH_NULL] = "PUSH_NULL",
+        [PUSH_INT] = "PUSH_INT",
+        [LOAD_CONST] = "LOAD_CONST",
+        [LOAD_LOCAl] = "LOAD_LOCAl",
+        [STORE_LOCAL] = "STORE_LOCAL",
+        [NEW] = "NEW",
+        [FREE] = "FREE",
+        [NULL_CHECK] = "NULL_CHECK",
+        [CHECK_CAST] = "CHECK_CAST",
+        [I2F] = "I2F",
+        [F2I] = "F2I",
+        [MAKE_ARRAY] = "MAKE_ARRAY",
+        [READ_ARRAY] = "READ_ARRAY",
+        [WRITE_ARRAY] = "WRITE_ARRAY",
+        [GET_FIELD] = "GET_FIELD",
+        [PUT_FIELD] = "PUT_FIELD",
+        [INVOKE_VIRTUAL] = "INVOKE_VIRTUAL",
+        [INVOKE_TEMPLATE] = "INVOKE_TEMPLATE",
+        [INVOKE_NATIVE] = "INVOKE_NATIVE",
+        [RETURN] = "RETURN",
+        [DUP] = "DUP",
+        [SWAP] = "SWAP",
+        [POP] = "POP",
+        [NOT] = "NOT",
+        [NEG] = "NEG",
+        [ADD_I] = "ADD_I",
+        [SUB_I] = "SUB_I",
+        [MUL_I] = "MUL_I",
+        [MOD] = "MOD",
+        [AND] = "AND",
+        [OR] = "OR",
+        [AND_BIT] = "AND_BIT",
+        [OR_BIT] = "OR_BIT",
+        [XOR] = "XOR",
+        [SHIFT_AL] = "SHIFT_AL",
+        [SHIFT_AR] = "SHIFT_AR",
+        [ADD_F] = "ADD_F",
+        [SUB_F] = "SUB_F",
+        [MUL_F] = "MUL_F",
+        [DIV] = "DIV",
+        [EQUALS] = "EQUALS",
+        [NOT_EQUALS] = "NOT_EQUALS",
+        [LESS] = "LESS",
+        [GREATER] = "GREATER",
+        [LESS_EQ] = "LESS_EQ",
+        [GREATER_EQ] = "GREATER_EQ",
+        [GOTO] = "GOTO",
+        [BRANCH_NOT_ZERO] = "BRANCH_NOT_ZERO",
+        [BRANCH_ZERO] = "BRANCH_ZERO",
+        [NEW_LINE] = "NEW_LINE",
+        [THROW] = "THROW",
+        [PAR_MAP] = "PAR_MAP",
+        [PAR_FILTER] = "PAR_FILTER",
+        [PAR_REDUCE] = "PAR_REDUCE",
+        [TABLESWITCH] = "TABLESWITCH",
+        [LOOKUPSWITCH] = "LOOKUPSWITCH",
+        [GET_FIELD_I8] = "GET_FIELD_I8",
+        [GET_FIELD_I32] = "GET_FIELD_I32",
+        [GET_FIELD_F32] = "GET_FIELD_F32",
+        [PUT_FIELD_I8] = "PUT_FIELD_I8",
+        [PUT_FIELD_I32] = "PUT_FIELD_I32",
+        [PUT_FIELD_F32] = "PUT_FIELD_F32",
+        [ADD_L] = "ADD_L",
+        [SUB_L] = "SUB_L",
+        [MUL_L] = "MUL_L",
+        [DIV_L] = "DIV_L",
+        [REM_L] = "REM_L",
+        [NEG_L] = "NEG_L",
+        [AND_L] = "AND_L",
+        [OR_L] = "OR_L",
+        [XOR_L] = "XOR_L",
+        [SHIFT_LL] = "SHIFT_LL",
+        [SHIFT_RL] = "SHIFT_RL",
+        [ADD_D] = "ADD_D",
+        [SUB_D] = "SUB_D",
+        [MUL_D] = "MUL_D",
+        [DIV_D] = "DIV_D",
+        [NEG_D] = "NEG_D",
+        [CMP_L] = "CMP_L",
+        [CMP_D] = "CMP_D",
+        [I2L] = "I2L",
+        [L2I] = "L2I",
+        [I2D] = "I2D",
+        [D2I] = "D2I",
+        [L2D] = "L2D",
+        [D2L] = "D2L",
+        [F2D] = "F2D",
+        [D2F] = "D2F",
+        [PUSH_CONST] = "PUSH_CONST",
+        [INVOKE_RESOLVED] = "INVOKE_RESOLVED",
+        [INVOKE_NATIVE_RESOLVED] = "INVOKE_NATIVE_RESOLVED",
+        [GET_FIELD_I8_RESOLVED] = "GET_FIELD_I8_RESOLVED",
+        [GET_FIELD_I32_RESOLVED] = "GET_FIELD_I32_RESOLVED",
+        [PUT_FIELD_I8_RESOLVED] = "PUT_FIELD_I8_RESOLVED",
+        [PUT_FIELD_I32_RESOLVED] = "PUT_FIELD_I32_RESOLVED",
+        [BREAKPOINT] = "BREAKPOINT",
+};
+
+
+bool optimize_enabled(){
+    char* value = getenv("RABBIT_OPTIMIZE");
+    return value == NULL || strcmp(value, "0") != 0;
+}
+
+bool dump_enabled(){
+    char* value = getenv("RABBIT_DUMP_BYTECODE");
+    return value != NULL && strcmp(value, "0") != 0;
+}
+
+int target_of(u_int8_t* inst){
+    return (inst[1] << 8) | inst[2];
+}
+
+void set_target(u_int8_t* at, int target){
+    at[0] = (target >> 8) & 0xFF;
+    at[1] = target & 0xFF;
+}
+
+bool is_branch(u_int8_t opc){
+    return opc == GOTO || opc == BRANCH_ZERO || opc == BRANCH_NOT_ZERO;
+}
+
+bool is_switch(u_int8_t opc){
+    return opc == TABLESWITCH || opc == LOOKUPSWITCH;
+}
+
+/* where target i of a switch is stored, -1 being the default */
+u_int8_t* switch_target_at(u_int8_t* inst, int i){
+    if (i == -1) return inst + 1;
+    return inst[0] == TABLESWITCH ? inst + 8 + 2*i : inst + 8 + 6*i;
+}
+
+void drop(V_Function* function, int ip){
+    free(function->instructions[ip]);
+    function->instructions[ip] = NULL;
+}
+
+void replace(V_Function* function, int ip, u_int8_t* inst){
+    free(function->instructions[ip]);
+    function->instructions[ip] = inst;
+}
+
+/* the first instruction at or after 'ip' that was not removed */
+int skip_removed(V_Function* function, int ip){
+    while (ip < function->length && function->instructions[ip] == NULL) ip++;
+    return ip;
+}
+
+u_int8_t* make_pop(){
+    u_int8_t* inst = malloc(1);
+    inst[0] = POP;
+    return inst;
+}
+
+u_int8_t* make_goto(int target){
+    u_int8_t* inst = malloc(3);
+    inst[0] = GOTO;
+    set_target(inst + 1, target);
+    return inst;
+}
+
+/* values that fit a byte become a PUSH_INT, all others the quickened PUSH_CONST */
+u_int8_t* make_constant(long value){
+    if (value >= 0 && value <= 255){
+        u_int8_t* inst = malloc(2);
+        inst[0] = PUSH_INT;
+        inst[1] = value;
+        return inst;
+    }
+    Quick_Inst* quick = malloc(sizeof(Quick_Inst));
+    quick->opcode = PUSH_CONST;
+    quick->argc = 0;
+    quick->operand = (void*) value;
+    return (u_int8_t*) quick;
+}
+
+/* the word pushed by 'inst' if it always pushes the same one */
+bool constant_value(Pool* pool, u_int8_t* inst, long* value){
+    switch (inst[0]) {
+        case PUSH_NULL:
+            *value = 0;
+            return TRUE;
+
+        case PUSH_INT:
+            *value = inst[1];
+            return TRUE;
+
+        case PUSH_CONST:
+            *value = (long) ((Quick_Inst*) inst)->operand;
+            return TRUE;
+
+        case LOAD_CONST:
+            if (pool->tags[inst[1]] == 2) return FALSE;
+            *value = (long) pool->values[inst[1]];
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+bool fold_unary(u_int8_t opc, long value, long* result){
+    switch (opc) {
+        case NOT:
+            *result = value ^ -1;
+            return TRUE;
+
+        case NEG:
+            *result = (long) (0UL - (unsigned long) value);
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+/* computes what the interpreter would; operations that fail at runtime are not folded */
+bool fold_binary(u_int8_t opc, long left, long right, long* result){
+    int l = (int) left;
+    int r = (int) right;
+
+    switch (opc) {
+        case ADD_I: *result = (int) ((unsigned) l + (unsigned) r); break;
+        case SUB_I: *result = (int) ((unsigned) l - (unsigned) r); break;
+        case MUL_I: *result = (int) ((unsigned) l * (unsigned) r); break;
+        case AND: *result = l && r; break;
+        case OR: *result = l || r; break;
+        case AND_BIT: *result = l & r; break;
+        case OR_BIT: *result = l | r; break;
+        case XOR: *result = l ^ r; break;
+        case EQUALS: *result = left == right; break;
+        case NOT_EQUALS: *result = left != right; break;
+        case LESS: *result = l < r; break;
+        case GREATER: *result = l > r; break;
+        case LESS_EQ: *result = l <= r; break;
+        case GREATER_EQ: *result = l >= r; break;
+
+        case MOD:
+            if (r == 0 || (l == INT_MIN && r == -1)) return FALSE;
+            *result = l % r;
+            break;
+
+        case SHIFT_AL:
+            if (r < 0 || r > 31) return FALSE;
+            *result = (int) ((unsigned) l << r);
+            break;
+
+        case SHIFT_AR:
+            if (r < 0 || r > 31) return FALSE;
+            *result = l >> r;
+            break;
+
+        default:
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* the last instruction of a block decides where control goes next */
+void link_block(V_Function* function, CFG* cfg, Block* block){
+    u_int8_t* last = NULL;
+    for (int ip = block->end - 1; ip >= block->start && last == NULL; ip--)
+        last = function->instructions[ip];
+
+    int switch_targets = last != NULL && is_switch(last[0]) ? switch_count(last) + 1 : 0;
+    block->succs = malloc(sizeof(int) * (switch_targets + 2));
+    block->succ_count = 0;
+
+    if (switch_targets > 0){
+        for (int i = -1; i < switch_count(last); i++)
+            block->succs[block->succ_count++] = cfg->block_of[switch_target(last, i)];
+        return;
+    }
+    if (last != NULL && is_branch(last[0]))
+        block->succs[block->succ_count++] = cfg->block_of[target_of(last)];
+    if (last != NULL && (last[0] == GOTO || last[0] == RETURN || last[0] == THROW))
+        return;
+    if (block->end < function->length)
+        block->succs[block->succ_count++] = cfg->block_of[block->end];
+}
+
+CFG* build_cfg(V_Function* function){
+    int length = function->length;
+    CFG* cfg = malloc(sizeof(CFG));
+    bool* leaders = calloc(length + 1, sizeof(bool));
+    cfg->leaders = leaders;
+    cfg->block_of = malloc(sizeof(int) * length);
+
+    leaders[0] = TRUE;
+    for (int i = 0; i < function->handler_count; i++){
+        Handler* handler = &function->handlers[i];
+        leaders[handler->start] = leaders[handler->end] = leaders[handler->target] = TRUE;
+    }
+    for (int ip = 0; ip < length; ip++){
+        u_int8_t* inst = function->instructions[ip];
+        if (inst == NULL) continue;
+
+        if (is_branch(inst[0]))
+            leaders[target_of(inst)] = TRUE;
+        else if (is_switch(inst[0]))
+            for (int i = -1; i < switch_count(inst); i++)
+                leaders[switch_target(inst, i)] = TRUE;
+        else if (inst[0] != RETURN && inst[0] != THROW)
+            continue;
+        leaders[ip + 1] = TRUE;
+    }
+
+    cfg->count = 0;
+    for (int ip = 0; ip < length; ip++)
+        if (leaders[ip]) cfg->count++;
+
+    cfg->blocks = calloc(cfg->count, sizeof(Block));
+    int b = -1;
+    for (int ip = 0; ip < length; ip++){
+        if (leaders[ip]) cfg->blocks[++b].start = ip;
+        cfg->blocks[b].end = ip + 1;
+        cfg->block_of[ip] = b;
+    }
+    for (b = 0; b < cfg->count; b++)
+        link_block(function, cfg, &cfg->blocks[b]);
+    return cfg;
+}
+
+void free_cfg(CFG* cfg){
+    for (int b = 0; b < cfg->count; b++)
+        free(cfg->blocks[b].succs);
+    free(cfg->blocks);
+    free(cfg->block_of);
+    free(cfg->leaders);
+    free(cfg);
+}
+
+/* the closest instruction before 'ip' in its block, -1 if 'ip' starts the block */
+int previous(V_Function* function, CFG* cfg, int ip){
+    while (!cfg->leaders[ip]){
+        ip--;
+        if (function->instructions[ip] != NULL) return ip;
+    }
+    return -1;
+}
+
+/* replaces operations on constants by their result, block by block */
+bool fold_constants(Pool* pool, V_Function* function, CFG* cfg){
+    bool changed = FALSE;
+    for (int ip = 0; ip < function->length; ip++){
+        u_int8_t* inst = function->instructions[ip];
+        if (inst == NULL) continue;
+
+        long left, right, result;
+        int a = previous(function, cfg, ip);
+        if (a == -1) continue;
+
+        /* reading a local has no effect either */
+        bool load = function->instructions[a][0] == LOAD_LOCAl;
+        if (!(load && inst[0] == POP) && !constant_value(pool, function->instructions[a], &left)) continue;
+
+        if (inst[0] == POP){
+            drop(function, ip);
+        }
+        else if (inst[0] == BRANCH_ZERO || inst[0] == BRANCH_NOT_ZERO){
+            if ((int) left == (inst[0] == BRANCH_ZERO ? 0 : 1))
+                replace(function, ip, make_goto(target_of(inst)));
+            else
+                drop(function, ip);
+        }
+        else if (fold_unary(inst[0], left, &result)){
+            replace(function, ip, make_constant(result));
+        }
+        else {
+            int b = previous(function, cfg, a);
+            if (b == -1 || !constant_value(pool, function->instructions[b], &right)
+                || !fold_binary(inst[0], left, right, &result))
+                continue;
+            replace(function, ip, make_constant(result));
+            drop(function, b);
+        }
+        drop(function, a);
+        changed = TRUE;
+    }
+    return changed;
+}
+
+/* follows a chain of GOTOs, giving up on a cycle */
+int final_target(V_Function* function, int target){
+    for (int hops = 0; hops < function->length; hops++){
+        int ip = skip_removed(function, target);
+        if (ip == function->length) return target;
+        if (function->instructions[ip][0] != GOTO) return ip;
+        target = target_of(function->instructions[ip]);
+    }
+    return target;
+}
+
+bool retarget(V_Function* function, u_int8_t* at){
+    int target = (at[0] << 8) | at[1];
+    int final = final_target(function, target);
+    if (final == target) return FALSE;
+    set_target(at, final);
+    return TRUE;
+}
+
+bool thread_jumps(V_Function* function){
+    bool changed = FALSE;
+    for (int ip = 0; ip < function->length; ip++){
+        u_int8_t* inst = function->instructions[ip];
+        if (inst == NULL) continue;
+
+        if (is_switch(inst[0])){
+            for (int i = -1; i < switch_count(inst); i++)
+                changed |= retarget(function, switch_target_at(inst, i));
+            continue;
+        }
+        if (!is_branch(inst[0])) continue;
+        changed |= retarget(function, inst + 1);
+
+        /* a branch to the next instruction only has to consume its operand */
+        if (skip_removed(function, target_of(inst)) != skip_removed(function, ip + 1)) continue;
+        if (inst[0] == GOTO)
+            drop(function, ip);
+        else
+            replace(function, ip, make_pop());
+        changed = TRUE;
+    }
+    return changed;
+}
+
+void reach(CFG* cfg, int block, int* worklist, int* pending){
+    if (cfg->blocks[block].reachable) return;
+    cfg->blocks[block].reachable = TRUE;
+    worklist[(*pending)++] = block;
+}
+
+/* handlers count as entry points, even if nothing in their range is reachable */
+bool remove_unreachable(V_Function* function, CFG* cfg){
+    int* worklist = malloc(sizeof(int) * cfg->count);
+    int pending = 0;
+    reach(cfg, 0, worklist, &pending);
+    for (int i = 0; i < function->handler_count; i++)
+        reach(cfg, cfg->block_of[function->handlers[i].target], worklist, &pending);
+
+    while (pending > 0){
+        Block* block = &cfg->blocks[worklist[--pending]];
+        for (int i = 0; i < block->succ_count; i++)
+            reach(cfg, block->succs[i], worklist, &pending);
+    }
+    free(worklist);
+
+    bool changed = FALSE;
+    for (int b = 0; b < cfg->count; b++){
+        Block* block = &cfg->blocks[b];
+        if (block->reachable) continue;
+        for (int ip = block->start; ip < block->end; ip++){
+            if (function->instructions[ip] == NULL) continue;
+            drop(function, ip);
+            changed = TRUE;
+        }
+    }
+    return changed;
+}
+
+bool has_local(Locals_Set* set, int local){
+    return (set->bits[local / 64] >> (local % 64)) & 1;
+}
+
+void add_local(Locals_Set* set, int local){
+    set->bits[local / 64] |= (u_int64_t) 1 << (local % 64);
+}
+
+void remove_local(Locals_Set* set, int local){
+    set->bits[local / 64] &= ~((u_int64_t) 1 << (local % 64));
+}
+
+bool add_all(Locals_Set* set, Locals_Set* from){
+    bool changed = FALSE;
+    for (int i = 0; i < MAX_LOCALS / 64; i++){
+        u_int64_t bits = set->bits[i] | from->bits[i];
+        changed |= bits != set->bits[i];
+        set->bits[i] = bits;
+    }
+    return changed;
+}
+
+Locals_Set live_out(CFG* cfg, Block* block){
+    Locals_Set live;
+    memset(&live, 0, sizeof(Locals_Set));
+    for (int i = 0; i < block->succ_count; i++)
+        add_all(&live, &cfg->blocks[block->succs[i]].live_in);
+    return live;
+}
+
+/* the locals read before being written from the start of 'block' on; dead[ip] is set
+ * for every load and store in it whose local is not read afterwards */
+Locals_Set live_before(V_Function* function, CFG* cfg, Block* block, bool* dead){
+    Locals_Set live = live_out(cfg, block);
+    for (int ip = block->end - 1; ip >= block->start; ip--){
+        u_int8_t* inst = function->instructions[ip];
+        if (inst == NULL) continue;
+
+        /* any instruction of a protected range may pass control to the handler */
+        for (int i = 0; i < function->handler_count; i++){
+            Handler* handler = &function->handlers[i];
+            if (ip >= handler->start && ip < handler->end)
+                add_all(&live, &cfg->blocks[cfg->block_of[handler->target]].live_in);
+        }
+
+        if (inst[0] != LOAD_LOCAl && inst[0] != STORE_LOCAL) continue;
+        if (dead != NULL) dead[ip] = !has_local(&live, inst[1]);
+        if (inst[0] == LOAD_LOCAl)
+            add_local(&live, inst[1]);
+        else
+            remove_local(&live, inst[1]);
+    }
+    return live;
+}
+
+void compute_liveness(V_Function* function, CFG* cfg){
+    bool changed = TRUE;
+    while (changed){
+        changed = FALSE;
+        for (int b = cfg->count - 1; b >= 0; b--){
+            Block* block = &cfg->blocks[b];
+            if (!block->reachable) continue;
+            Locals_Set live = live_before(function, cfg, block, NULL);
+            changed |= add_all(&block->live_in, &live);
+        }
+    }
+}
+
+bool remove_dead_stores(V_Function* function, CFG* cfg){
+    compute_liveness(function, cfg);
+    bool* dead = calloc(function->length, sizeof(bool));
+    for (int b = 0; b < cfg->count; b++){
+        if (cfg->blocks[b].reachable)
+            live_before(function, cfg, &cfg->blocks[b], dead);
+    }
+
+    bool changed = FALSE;
+    for (int ip = 0; ip < function->length; ip++){
+        u_int8_t* inst = function->instructions[ip];
+        if (inst == NULL || inst[0] != STORE_LOCAL) continue;
+
+        int next = skip_removed(function, ip + 1);
+        u_int8_t* load = next < function->length && cfg->block_of[next] == cfg->block_of[ip]
+                ? function->instructions[next] : NULL;
+
+        if (load != NULL && load[0] == LOAD_LOCAl && load[1] == inst[1] && dead[next]){
+            /* the value stays on the stack instead of going through the local */
+            drop(function, ip);
+            drop(function, next);
+            changed = TRUE;
+        }
+        else if (dead[ip]){
+            replace(function, ip, make_pop());
+            changed = TRUE;
+        }
+    }
+    free(dead);
+    return changed;
+}
+
+/* closes the gaps left by removed instructions */
+void compact(V_Function* function){
+    int length = function->length;
+    int* map = malloc(sizeof(int) * (length + 1));
+    int n = 0;
+    for (int ip = 0; ip < length; ip++){
+        map[ip] = n;
+        if (function->instructions[ip] != NULL) n++;
+    }
+    map[length] = n;
+
+    n = 0;
+    for (int ip = 0; ip < length; ip++){
+        u_int8_t* inst = function->instructions[ip];
+        if (inst == NULL) continue;
+        remap_branches(inst, map);
+        function->instructions[n++] = inst;
+    }
+    function->length = n;
+
+    /* a handler whose whole range was removed is dropped */
+    int count = 0;
+    for (int i = 0; i < function->handler_count; i++){
+        Handler handler = function->handlers[i];
+        handler.start = map[handler.start];
+        handler.end = map[handler.end];
+        handler.target = map[handler.target];
+        if (handler.start < handler.end)
+            function->handlers[count++] = handler;
+    }
+    function->handler_count = count;
+    free(map);
+}
+
+bool run_passes(Pool* pool, V_Function* function){
+    CFG* cfg = build_cfg(function);
+    bool changed = fold_constants(pool, function, cfg);
+    free_cfg(cfg);
+    changed |= thread_jumps(function);
+
+    cfg = build_cfg(function);
+    changed |= remove_unreachable(function, cfg);
+    changed |= remove_dead_stores(function, cfg);
+    free_cfg(cfg);
+    return changed;
+}
+
+void dump_operands(u_int8_t* inst){
+    switch (inst[0]) {
+        case PUSH_CONST:
+            fprintf(stderr, " %ld", (long) ((Quick_Inst*) inst)->operand);
+            break;
+
+        case GOTO:
+        case BRANCH_ZERO:
+        case BRANCH_NOT_ZERO:
+            fprintf(stderr, " -> %d", target_of(inst));
+            break;
+
+        case NEW_LINE:
+            fprintf(stderr, " %d", target_of(inst));
+            break;
+
+        case TABLESWITCH:
+        case LOOKUPSWITCH:
+        {
+            int low = int_from_4_bytes(inst + 3);
+            for (int i = 0; i < switch_count(inst); i++){
+                int key = inst[0] == TABLESWITCH ? low + i : switch_key(inst, i);
+                fprintf(stderr, " %d -> %d,", key, switch_target(inst, i));
+            }
+            fprintf(stderr, " default -> %d", switch_target(inst, -1));
+        }
+            break;
+
+        default:
+            for (int i = 1; i < instruction_length(inst); i++)
+                fprintf(stderr, " %d", inst[i]);
+    }
+}
+
+void dump_function(V_Function* function){
+    fprintf(stderr, "%s (arity %d, locals %d, stack %d)\n",
+            function->name, function->arity, function->locals, function->op_stack);
+    for (int ip = 0; ip < function->length; ip++){
+        u_int8_t* inst = function->instructions[ip];
+        fprintf(stderr, "%6d  %s", ip, opcode_names[inst[0]]);
+        dump_operands(inst);
+        fprintf(stderr, "\n");
+    }
+    for (int i = 0; i < function->handler_count; i++){
+        Handler* handler = &function->handlers[i];
+        fprintf(stderr, "        handler %d..%d -> %d\n", handler->start, handler->end, handler->target);
+    }
+}
+
+/* only rewrites 'function' itself, so different functions can be optimized at the same time */
+void optimize_body(Pool* pool, V_Function* function){
+    /* each round can expose more work, like a branch to code that was just removed */
+    int rounds = 0;
+    while (rounds < MAX_ROUNDS && optimize_enabled() && run_passes(pool, function)){
+        compact(function);
+        rounds++;
+    }
+    if (rounds > 0){
+        /* recomputes the operand stack size for the new body */
+        function->verified = FALSE;
+        verify_function(pool, function);
+    }
+}
+
+void optimize_function(Loaded* loaded, V_Function* function){
+    if (!function->verified) return;
+    optimize_body(loaded->pool, function);
+    if (dump_enabled())
+        dump_function(function);
+}
+
+void optimize_entry(void* pool, int i){
+    V_Function* function = ((Pool*) pool)->values[i];
+    if (((Pool*) pool)->tags[i] == 3 && function->verified)
+        optimize_body(pool, function);
+}
+
+/* functions are optimized in parallel and dumped in pool order afterwards */
+void optimize_all(Loaded* loaded){
+    Pool* pool = loaded->pool;
+    parallel_for(pool->size, optimize_entry, pool);
+    for (int i = 0; i < pool->size; i++){
+        if (pool->tags[i] == 3 && ((V_Function*) pool->values[i])->verified && dump_enabled())
+            dump_function(pool->values[i]);
+    }
+}
@@ -0,0 +1,19 @@
+#include <stdlib.h>
+
+/*
+ * Load-time optimizer, run on every function after verification and inlining.
+ * It splits the body into basic blocks and
+ *  - folds integer arithmetic, comparisons and branches on constant operands,
+ *  - threads branches to a GOTO through to its final target,
+ *  - removes blocks that can not be reached,
+ *  - turns stores to locals that are never read again into POPs and drops a
+ *    STORE_LOCAL/LOAD_LOCAl pair of a dead local altogether.
+ * The rewritten body is verified again. Set RABBIT_OPTIMIZE=0 to disable it and
+ * RABBIT_DUMP_BYTECODE=1 to print every function on stderr once it is prepared.
+ */
+struct loaded;
+struct v_function;
+
+void optimize_function(struct loaded* loaded, struct v_function* function);
+
+void optimize_all(struct loaded* loaded);
@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <limits.h>
+#include "env.h"
+#include "parallel.h"
+
+#define CHUNK_SIZE 256
+#define MAX_WORKERS 64
+/* fewer iterations of a parallel_for are not worth starting threads for */
+#define PARALLEL_FOR_MIN 64
+
+enum Job_Kind {
+    JOB_APPLY,
+    JOB_FOLD,
+};
+
+typedef struct job {
+    int kind;
+    V_Function* function;
+    void** elements;
+    int length;
+    void** results;
+    /* the lowest chunk a worker failed in and how; chunks above it are skipped */
+    pthread_mutex_t lock;
+    int failed_chunk;
+    int status;
+    R_Object* exception;
+} Job;
+
+/* chunks next..end-1 are left; the owner takes from the front, thieves from the back */
+typedef struct chunk_range {
+    pthread_mutex_t lock;
+    int next;
+    int end;
+} Chunk_Range;
+
+typedef struct worker_thread {
+    Workers* workers;
+    int index;
+} Worker_Thread;
+
+typedef struct workers {
+    int count;
+    Context** contexts;
+    Chunk_Range* ranges;
+    pthread_t* threads;
+    Worker_Thread* args;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    int generation;
+    int busy;
+    bool shutdown;
+    Job* job;
+} Workers;
+
+
+void init_job(Job* job, int kind, V_Function* function, void** elements, int length, void** results){
+    job->kind = kind;
+    job->function = function;
+    job->elements = elements;
+    job->length = length;
+    job->results = results;
+    pthread_mutex_init(&job->lock, NULL);
+    job->failed_chunk = INT_MAX;
+    job->status = EXEC_OK;
+    job->exception = NULL;
+}
+
+/* keeps the failure of the lowest chunk, the one a sequential run would have stopped at */
+void fail_chunk(Context* ctx, Job* job, int chunk){
+    pthread_mutex_lock(&job->lock);
+    if (chunk < job->failed_chunk){
+        __atomic_store_n(&job->failed_chunk, chunk, __ATOMIC_RELAXED);
+        job->status = get_exit_status(ctx);
+        job->exception = get_exception(ctx);
+    }
+    pthread_mutex_unlock(&job->lock);
+    set_failure(ctx, EXEC_OK, NULL);
+}
+
+void run_chunk(Context* ctx, Job* job, int chunk){
+    int start = chunk * CHUNK_SIZE;
+    int end = start + CHUNK_SIZE < job->length ? start + CHUNK_SIZE : job->length;
+    if (chunk > __atomic_load_n(&job->failed_chunk, __ATOMIC_RELAXED)) return;
+
+    if (job->kind == JOB_APPLY){
+        for (int i = start; i < end && !has_failed(ctx); i++)
+            job->results[i] = run_function(ctx, job->function, &job->elements[i], 1);
+    }
+    else {
+        void* acc = job->elements[start];
+        for (int i = start + 1; i < end && !has_failed(ctx); i++){
+            void* args[2] = {acc, job->elements[i]};
+            acc = run_function(ctx, job->function, args, 2);
+        }
+        job->results[chunk] = acc;
+    }
+
+    settle_budget(ctx);
+    if (has_failed(ctx))
+        fail_chunk(ctx, job, chunk);
+}
+
+int take_chunk(Workers* workers, int self){
+    for (int k = 0; k < workers->count; k++){
+        Chunk_Range* range = &workers->ranges[(self + k) % workers->count];
+        int chunk = -1;
+        pthread_mutex_lock(&range->lock);
+        if (range->next < range->end)
+            chunk = k == 0 ? range->next++ : --range->end;
+        pthread_mutex_unlock(&range->lock);
+        if (chunk != -1) return chunk;
+    }
+    return -1;
+}
+
+void work(Workers* workers, int self){
+    int chunk;
+    while ((chunk = take_chunk(workers, self)) != -1)
+        run_chunk(workers->contexts[self], workers->job, chunk);
+}
+
+void* worker_main(void* arg){
+    Worker_Thread* thread = arg;
+    Workers* workers = thread->workers;
+    int seen = 0;
+
+    pthread_mutex_lock(&workers->lock);
+    while (TRUE){
+        while (!workers->shutdown && workers->generation == seen)
+            pthread_cond_wait(&workers->start, &workers->lock);
+        if (workers->shutdown) break;
+        seen = workers->generation;
+        pthread_mutex_unlock(&workers->lock);
+
+        work(workers, thread->index);
+
+        pthread_mutex_lock(&workers->lock);
+        if (--workers->busy == 0)
+            pthread_cond_signal(&workers->done);
+    }
+    pthread_mutex_unlock(&workers->lock);
+    return NULL;
+}
+
+int thread_count(){
+    char* value = getenv("RABBIT_THREADS");
+    long count = value != NULL ? atol(value) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (count < 1) count = 1;
+    if (count > MAX_WORKERS) count = MAX_WORKERS;
+    return (int) count;
+}
+
+Workers* workers_open(Context* ctx){
+    Workers* workers = malloc(sizeof(Workers));
+    workers->count = thread_count();
+    workers->contexts = malloc(sizeof(Context*) * workers->count);
+    workers->ranges = malloc(sizeof(Chunk_Range) * workers->count);
+    workers->threads = malloc(sizeof(pthread_t) * workers->count);
+    workers->args = malloc(sizeof(Worker_Thread) * workers->count);
+    pthread_mutex_init(&workers->lock, NULL);
+    pthread_cond_init(&workers->start, NULL);
+    pthread_cond_init(&workers->done, NULL);
+    workers->generation = 0;
+    workers->busy = 0;
+    workers->shutdown = FALSE;
+    workers->job = NULL;
+
+    for (int i = 0; i < workers->count; i++){
+        workers->contexts[i] = new_worker_context(ctx);
+        pthread_mutex_init(&workers->ranges[i].lock, NULL);
+        workers->args[i].workers = workers;
+        workers->args[i].index = i;
+    }
+    /* worker 0 is the calling thread; the pool shrinks to the threads that could be started */
+    for (int i = 1; i < workers->count; i++){
+        if (pthread_create(&workers->threads[i], NULL, worker_main, &workers->args[i]) == 0) continue;
+        for (int j = i; j < workers->count; j++){
+            free_worker_context(workers->contexts[j]);
+            pthread_mutex_destroy(&workers->ranges[j].lock);
+        }
+        workers->count = i;
+    }
+    return workers;
+}
+
+void workers_close(Workers* workers){
+    pthread_mutex_lock(&workers->lock);
+    workers->shutdown = TRUE;
+    pthread_cond_broadcast(&workers->start);
+    pthread_mutex_unlock(&workers->lock);
+
+    for (int i = 1; i < workers->count; i++)
+        pthread_join(workers->threads[i], NULL);
+    for (int i = 0; i < workers->count; i++){
+        free_worker_context(workers->contexts[i]);
+        pthread_mutex_destroy(&workers->ranges[i].lock);
+    }
+    pthread_mutex_destroy(&workers->lock);
+    pthread_cond_destroy(&workers->start);
+    pthread_cond_destroy(&workers->done);
+    free(workers->contexts);
+    free(workers->ranges);
+    free(workers->threads);
+    free(workers->args);
+    free(workers);
+}
+
+void run_pool(Workers* workers, Job* job, int chunks){
+    for (int i = 0; i < workers->count; i++){
+        workers->ranges[i].next = (int)((long) chunks * i / workers->count);
+        workers->ranges[i].end = (int)((long) chunks * (i + 1) / workers->count);
+    }
+
+    pthread_mutex_lock(&workers->lock);
+    workers->job = job;
+    workers->busy = workers->count - 1;
+    workers->generation++;
+    pthread_cond_broadcast(&workers->start);
+    pthread_mutex_unlock(&workers->lock);
+
+    work(workers, 0);
+
+    pthread_mutex_lock(&workers->lock);
+    while (workers->busy > 0)
+        pthread_cond_wait(&workers->done, &workers->lock);
+    workers->job = NULL;
+    pthread_mutex_unlock(&workers->lock);
+}
+
+/* a failed chunk is left on ctx for the caller to rethrow */
+void run_job(Context* ctx, Job* job){
+    int chunks = (job->length + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    Workers* workers = get_workers(ctx);
+
+    /* nested parallel operations run sequentially on a fresh context */
+    if (workers == NULL){
+        Context* worker = new_worker_context(ctx);
+        for (int chunk = 0; chunk < chunks; chunk++)
+            run_chunk(worker, job, chunk);
+        free_worker_context(worker);
+    }
+    else {
+        run_pool(workers, job, chunks);
+    }
+
+    if (job->failed_chunk != INT_MAX)
+        set_failure(ctx, job->status, job->exception);
+}
+
+typedef struct loop {
+    void (*body)(void* arg, int i);
+    void* arg;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+} Loop;
+
+void* loop_main(void* arg){
+    Loop* loop = arg;
+    while (TRUE){
+        pthread_mutex_lock(&loop->lock);
+        int i = loop->next++;
+        pthread_mutex_unlock(&loop->lock);
+        if (i >= loop->count) break;
+        loop->body(loop->arg, i);
+    }
+    return NULL;
+}
+
+/* used while loading, before there is a context and its pool; the threads only live for one call */
+void parallel_for(int count, void (*body)(void* arg, int i), void* arg){
+    if (count < PARALLEL_FOR_MIN){
+        for (int i = 0; i < count; i++)
+            body(arg, i);
+        return;
+    }
+
+    int threads = thread_count() < count ? thread_count() : count;
+    pthread_t* ids = malloc(sizeof(pthread_t) * threads);
+    Loop loop = {.body = body, .arg = arg, .count = count, .next = 0};
+    pthread_mutex_init(&loop.lock, NULL);
+
+    /* iterations a thread could not be started for are taken by the others, the calling thread included */
+    int started = 1;
+    while (started < threads && pthread_create(&ids[started], NULL, loop_main, &loop) == 0)
+        started++;
+    loop_main(&loop);
+    for (int t = 1; t < started; t++)
+        pthread_join(ids[t], NULL);
+    pthread_mutex_destroy(&loop.lock);
+    free(ids);
+}
+
+void par_apply(Context* ctx, V_Function* function, void** elements, int length, void** results){
+    if (length == 0) return;
+    Job job;
+    init_job(&job, JOB_APPLY, function, elements, length, results);
+    run_job(ctx, &job);
+    pthread_mutex_destroy(&job.lock);
+}
+
+void* par_reduce(Context* ctx, V_Function* function, void** elements, int length, void* init){
+    if (length == 0) return init;
+
+    int chunks = (length + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    void** partials = malloc(sizeof(void*) * chunks);
+    Job job;
+    init_job(&job, JOB_FOLD, function, elements, length, partials);
+    run_job(ctx, &job);
+    pthread_mutex_destroy(&job.lock);
+    if (has_failed(ctx)){
+        free(partials);
+        return init;
+    }
+
+    Context* worker = new_worker_context(ctx);
+    void* acc = init;
+    for (int chunk = 0; chunk < chunks && !has_failed(worker); chunk++){
+        void* args[2] = {acc, partials[chunk]};
+        acc = run_function(worker, function, args, 2);
+    }
+    set_failure(ctx, get_exit_status(worker), get_exception(worker));
+    free_worker_context(worker);
+    free(partials);
+    return acc;
+}
@@ -0,0 +1,34 @@
+#include <stdlib.h>
+
+/*
+ * Data-parallel intrinsics behind PAR_MAP, PAR_FILTER and PAR_REDUCE. The array
+ * is cut into fixed-size chunks that are spread over a pool of threads (the
+ * calling thread included); a worker that runs out of chunks steals from the
+ * back of another worker's range. Every worker runs on its own context that
+ * shares the loaded image, so the functions must not touch shared state.
+ *
+ * Results are written by element index and chunks are combined in array order,
+ * so the outcome does not depend on the number of threads (RABBIT_THREADS,
+ * default: number of processors). A reduce function must be associative.
+ *
+ * Workers draw on the caller's budget. An exception the function does not
+ * catch or an exceeded budget skips the chunks after it and is left on ctx
+ * (see has_failed) for the caller to rethrow; the lowest failed chunk wins.
+ */
+struct context;
+struct v_function;
+
+typedef struct workers Workers;
+
+Workers* workers_open(struct context* ctx);
+
+void workers_close(Workers* workers);
+
+/* results[i] is the result of calling 'function' with elements[i] */
+void par_apply(struct context* ctx, struct v_function* function, void** elements, int length, void** results);
+
+/* folds the elements left to right starting with 'init' */
+void* par_reduce(struct context* ctx, struct v_function* function, void** elements, int length, void* init);
+
+/* calls body(arg, i) for every i below count, spread over RABBIT_THREADS threads if count is large enough to pay for them */
+void parallel_for(int count, void (*body)(void* arg, int i), void* arg);
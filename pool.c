@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include "utils.h"
+#include "str.h"
 #include <stdio.h>
 
 typedef struct pool Pool;
@@ -20,13 +21,25 @@ u_int8_t consume(u_int8_t** content, int* cursor){
 }
 
 int load_int(u_int8_t** content, int* cursor){
-    int i = ((consume(content, cursor) & 0xFF) << 24) |
-        ((consume(content, cursor) & 0xFF) << 16) |
-        ((consume(content, cursor) & 0xFF) << 8) |
-        ((consume(content, cursor) & 0xFF));
-    return i;
+    /* one byte at a time, the operands of | may be evaluated in any order */
+    u_int32_t i = 0;
+    for (int k = 0; k < 4; k++)
+        i = (i << 8) | consume(content, cursor);
+    return (int) i;
 }
 
+int load_short(u_int8_t** content, int* cursor){
+    int high = consume(content, cursor);
+    int low = consume(content, cursor);
+    return (high << 8) | low;
+}
+
+
+long load_long(u_int8_t** content, int* cursor){
+    unsigned long high = (unsigned int) load_int(content, cursor);
+    unsigned long low = (unsigned int) load_int(content, cursor);
+    return (long)((high << 32) | low);
+}
 
 char* load_string(u_int8_t** content, int* cursor){
     int length = load_int(content, cursor);
@@ -39,6 +52,13 @@ char* load_string(u_int8_t** content, int* cursor){
     return str;
 }
 
+char* load_interned_string(u_int8_t** content, int* cursor){
+    int length = load_int(content, cursor);
+    char* str = intern_string((char*)(*content + *cursor), length);
+    *cursor += length;
+    return str;
+}
+
 Pool* load_pool(u_int8_t** content, int* cursor){
     Pool* pool = malloc(sizeof(Pool));
     u_int8_t size = consume(content, cursor);
@@ -58,6 +78,15 @@ Pool* load_pool(u_int8_t** content, int* cursor){
                 break;
 
             case 2:
+                pool->values[i] = load_interned_string(content, cursor);
+                break;
+
+            /* 64-bit integers and doubles, stored as their 8 bytes */
+            case 7:
+            case 8:
+                pool->values[i] = (void*) load_long(content, cursor);
+                break;
+
             case 3:
             case 4:
             case 5:
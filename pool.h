@@ -17,4 +17,10 @@ u_int8_t consume(u_int8_t** content, int* cursor);
 
 int load_int(u_int8_t** content, int* cursor);
 
+int load_short(u_int8_t** content, int* cursor);
+
+long load_long(u_int8_t** content, int* cursor);
+
 char* load_string(u_int8_t** content, int* cursor);
+
+char* load_interned_string(u_int8_t** content, int* cursor);
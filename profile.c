@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "map.h"
+#include "profile.h"
+
+typedef struct alloc_record {
+    Alloc_Stats* type;
+    Alloc_Stats* site;
+    long bytes;
+} Alloc_Record;
+
+
+Heap_Profile* profile_open(){
+    char* enabled = getenv("RABBIT_HEAP_PROFILE");
+    if (enabled == NULL || strcmp(enabled, "0") == 0) return NULL;
+
+    Heap_Profile* profile = malloc(sizeof(Heap_Profile));
+    profile->types = map_new(0);
+    profile->sites = map_new(0);
+    profile->live = map_new(0);
+    profile->live_bytes = 0;
+    profile->peak_bytes = 0;
+    return profile;
+}
+
+Alloc_Stats* stats_of(Map* map, void* key, char* name, int line){
+    Alloc_Stats* stats;
+    if (map_get(map, key, (void**)&stats))
+        return stats;
+
+    stats = calloc(1, sizeof(Alloc_Stats));
+    stats->name = name;
+    stats->line = line;
+    map_put(map, key, stats);
+    return stats;
+}
+
+/* sites are keyed by the allocating function and then by the line within it */
+Alloc_Stats* site_of(Heap_Profile* profile, char* func_name, int line){
+    Map* lines;
+    if (!map_get(profile->sites, func_name, (void**)&lines)){
+        lines = map_new(0);
+        map_put(profile->sites, func_name, lines);
+    }
+    return stats_of(lines, (void*)(long) line, func_name, line);
+}
+
+void count_alloc(Alloc_Stats* stats, long bytes){
+    stats->total_count++;
+    stats->live_count++;
+    stats->live_bytes += bytes;
+    if (stats->live_count > stats->peak_count) stats->peak_count = stats->live_count;
+    if (stats->live_bytes > stats->peak_bytes) stats->peak_bytes = stats->live_bytes;
+}
+
+void count_free(Alloc_Stats* stats, long bytes){
+    stats->live_count--;
+    stats->live_bytes -= bytes;
+}
+
+void profile_alloc(Heap_Profile* profile, void* ptr, char* type_name, long bytes, char* func_name, int line){
+    Alloc_Record* record = malloc(sizeof(Alloc_Record));
+    record->type = stats_of(profile->types, type_name, type_name, -1);
+    record->site = site_of(profile, func_name, line);
+    record->bytes = bytes;
+
+    count_alloc(record->type, bytes);
+    count_alloc(record->site, bytes);
+    map_put(profile->live, ptr, record);
+
+    profile->live_bytes += bytes;
+    if (profile->live_bytes > profile->peak_bytes) profile->peak_bytes = profile->live_bytes;
+}
+
+void profile_free(Heap_Profile* profile, void* ptr){
+    Alloc_Record* record;
+    if (!map_get(profile->live, ptr, (void**)&record))
+        return;
+
+    count_free(record->type, record->bytes);
+    count_free(record->site, record->bytes);
+    profile->live_bytes -= record->bytes;
+    map_remove(profile->live, ptr);
+    free(record);
+}
+
+int by_live_bytes(const void* a, const void* b){
+    long left = (*(Alloc_Stats**)a)->live_bytes;
+    long right = (*(Alloc_Stats**)b)->live_bytes;
+    return (left < right) - (left > right);
+}
+
+int collect_stats(Map* map, Alloc_Stats** stats, int i){
+    for (int cursor = map_next(map, -1); cursor != -1; cursor = map_next(map, cursor))
+        stats[i++] = map_value_at(map, cursor);
+    return i;
+}
+
+Alloc_Stats** sort_stats(Alloc_Stats** stats, int count){
+    qsort(stats, count, sizeof(Alloc_Stats*), by_live_bytes);
+    stats[count] = NULL;
+    return stats;
+}
+
+Alloc_Stats** sorted_stats(Map* map){
+    Alloc_Stats** stats = malloc(sizeof(Alloc_Stats*) * (map->size + 1));
+    return sort_stats(stats, collect_stats(map, stats, 0));
+}
+
+Alloc_Stats** sorted_sites(Map* sites){
+    int count = 0;
+    for (int cursor = map_next(sites, -1); cursor != -1; cursor = map_next(sites, cursor))
+        count += ((Map*) map_value_at(sites, cursor))->size;
+
+    Alloc_Stats** stats = malloc(sizeof(Alloc_Stats*) * (count + 1));
+    int i = 0;
+    for (int cursor = map_next(sites, -1); cursor != -1; cursor = map_next(sites, cursor))
+        i = collect_stats(map_value_at(sites, cursor), stats, i);
+    return sort_stats(stats, i);
+}
+
+void profile_report(Heap_Profile* profile){
+    fprintf(stderr, "\n--- heap profile ---\n");
+    fprintf(stderr, "live bytes: %ld, high-water mark: %ld bytes\n\n", profile->live_bytes, profile->peak_bytes);
+
+    fprintf(stderr, "%-24s %10s %12s %10s %12s %10s\n",
+            "type", "live", "live bytes", "peak", "peak bytes", "allocs");
+    Alloc_Stats** types = sorted_stats(profile->types);
+    for (Alloc_Stats** t = types; *t != NULL; t++){
+        fprintf(stderr, "%-24s %10ld %12ld %10ld %12ld %10ld\n",
+                (*t)->name, (*t)->live_count, (*t)->live_bytes, (*t)->peak_count, (*t)->peak_bytes, (*t)->total_count);
+    }
+    free(types);
+
+    fprintf(stderr, "\nnever freed, by allocation site:\n");
+    Alloc_Stats** sites = sorted_sites(profile->sites);
+    for (Alloc_Stats** s = sites; *s != NULL && (*s)->live_count > 0; s++){
+        fprintf(stderr, "  %s: line %d  %ld objects, %ld bytes\n",
+                (*s)->name, (*s)->line, (*s)->live_count, (*s)->live_bytes);
+    }
+    free(sites);
+}
+
+void free_stats(Map* map){
+    for (int cursor = map_next(map, -1); cursor != -1; cursor = map_next(map, cursor))
+        free(map_value_at(map, cursor));
+    map_free(map);
+}
+
+void profile_close(Heap_Profile* profile){
+    profile_report(profile);
+    free_stats(profile->types);
+    for (int cursor = map_next(profile->sites, -1); cursor != -1; cursor = map_next(profile->sites, cursor))
+        free_stats(map_value_at(profile->sites, cursor));
+    map_free(profile->sites);
+    free_stats(profile->live);
+    free(profile);
+}
@@ -0,0 +1,34 @@
+#include <stdlib.h>
+
+/*
+ * Heap allocation accounting, enabled with RABBIT_HEAP_PROFILE=1. Tracks live
+ * objects per type and per allocating function/line and prints high-water
+ * marks and the objects that were never freed when the context shuts down.
+ */
+typedef struct alloc_stats {
+    char* name;
+    int line;
+    long live_count;
+    long live_bytes;
+    long peak_count;
+    long peak_bytes;
+    long total_count;
+} Alloc_Stats;
+
+typedef struct heap_profile {
+    struct map* types;
+    struct map* sites;
+    struct map* live;
+    long live_bytes;
+    long peak_bytes;
+} Heap_Profile;
+
+Heap_Profile* profile_open();
+
+void profile_alloc(Heap_Profile* profile, void* ptr, char* type_name, long bytes, char* func_name, int line);
+
+void profile_free(Heap_Profile* profile, void* ptr);
+
+void profile_report(Heap_Profile* profile);
+
+void profile_close(Heap_Profile* profile);
@@ -1,40 +1,425 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "utils.h"
+#include "str.h"
+#include "map.h"
+#include "io.h"
+#include "env.h"
+#include "rni.h"
 #include <string.h>
 
-void* println(void* arg){
+void* println(void** args){
+    char* arg = args[0];
     if(arg == NULL)
         printf("%s\n", "null");
     else
-        printf("%s\n", (char*)arg);
+        printf("%s\n", arg);
     return NULL;
 }
 
+void* str_length(void** args){
+    return (void*)(long)string_length(args[0]);
+}
+
+void* str_hash(void** args){
+    return (void*)(long)(int)string_hash(args[0]);
+}
+
+void* str_concat(void** args){
+    return string_concat(args[0], args[1]);
+}
+
+void* str_substring(void** args){
+    return string_substring(args[0], (int)(long)args[1], (int)(long)args[2]);
+}
+
+void* str_index_of(void** args){
+    return (void*)(long)string_index_of(args[0], args[1]);
+}
+
+void* str_char_at(void** args){
+    char* str = args[0];
+    int idx = (int)(long)args[1];
+    if (idx < 0 || idx >= string_length(str))
+        return (void*)(long)-1;
+    return (void*)(long)(u_int8_t)str[idx];
+}
+
+void* str_from_int(void** args){
+    return string_from_int((int)(long)args[0]);
+}
+
+void* str_from_long(void** args){
+    char buffer[32];
+    int length = snprintf(buffer, sizeof(buffer), "%ld", (long) args[0]);
+    return string_new(buffer, length);
+}
+
+void* str_from_double(void** args){
+    union {
+        void* word;
+        double d;
+    } converter;
+    converter.word = args[0];
+    char buffer[32];
+    int length = snprintf(buffer, sizeof(buffer), "%.17g", converter.d);
+    return string_new(buffer, length);
+}
+
+void* str_to_int(void** args){
+    return (void*)(long)atoi(args[0]);
+}
+
+void* str_equals(void** args){
+    if (args[0] == NULL || args[1] == NULL)
+        return (void*)(long)(args[0] == args[1]);
+    return (void*)(long)string_content_equals(args[0], args[1]);
+}
+
+void* str_intern(void** args){
+    return string_intern(args[0]);
+}
+
+void* str_release(void** args){
+    string_free(args[0]);
+    return NULL;
+}
+
+void* sb_new(void** args){
+    (void) args;
+    return builder_new();
+}
+
+void* sb_append(void** args){
+    String_Builder* builder = args[0];
+    char* str = args[1];
+    if (str == NULL)
+        builder_append(builder, "null", 4);
+    else
+        builder_append(builder, str, string_length(str));
+    return builder;
+}
+
+void* sb_append_int(void** args){
+    char buffer[16];
+    int length = snprintf(buffer, sizeof(buffer), "%d", (int)(long)args[1]);
+    builder_append(args[0], buffer, length);
+    return args[0];
+}
+
+void* sb_build(void** args){
+    return builder_build(args[0]);
+}
+
+void* sb_release(void** args){
+    builder_free(args[0]);
+    return NULL;
+}
+
+void* map_create(void** args){
+    (void) args;
+    return map_new(0);
+}
+
+void* map_set(void** args){
+    map_put(args[0], args[1], args[2]);
+    return args[0];
+}
+
+void* map_lookup(void** args){
+    void* value;
+    if (map_get(args[0], args[1], &value))
+        return value;
+    return NULL;
+}
+
+void* map_has(void** args){
+    void* value;
+    return (void*)(long)map_get(args[0], args[1], &value);
+}
+
+void* map_delete(void** args){
+    return (void*)(long)map_remove(args[0], args[1]);
+}
+
+void* map_length(void** args){
+    return (void*)(long)((Map*)args[0])->size;
+}
+
+void* map_iter(void** args){
+    return (void*)(long)map_next(args[0], -1);
+}
+
+void* map_iter_next(void** args){
+    return (void*)(long)map_next(args[0], (int)(long)args[1]);
+}
+
+void* map_key(void** args){
+    return map_key_at(args[0], (int)(long)args[1]);
+}
+
+void* map_value(void** args){
+    return map_value_at(args[0], (int)(long)args[1]);
+}
+
+R_Object* map_to_array(Map* map, void* (*read)(Map*, int)){
+    R_Object* arr = new_array(map->size);
+    note_allocation(sizeof(R_Object) + sizeof(void*) * (map->size + 1));
+    int i = 1;
+    for (int cursor = map_next(map, -1); cursor != -1; cursor = map_next(map, cursor))
+        arr->content[i++] = read(map, cursor);
+    return arr;
+}
+
+void* map_keys(void** args){
+    return map_to_array(args[0], map_key_at);
+}
+
+void* map_values(void** args){
+    return map_to_array(args[0], map_value_at);
+}
+
+void* map_from_arrays(void** args){
+    R_Object* keys = args[0];
+    R_Object* values = args[1];
+    int size = array_length(keys);
+    if (array_length(values) < size) size = array_length(values);
+
+    Map* map = map_new(size);
+    for (int i = 1; i <= size; i++)
+        map_put(map, keys->content[i], values->content[i]);
+    return map;
+}
+
+void* map_release(void** args){
+    map_free(args[0]);
+    return NULL;
+}
+
+void* io_open(void** args){
+    return stream_open(args[0], args[1]);
+}
+
+void* io_stdin(void** args){
+    (void) args;
+    return stream_stdin();
+}
+
+void* io_stdout(void** args){
+    (void) args;
+    return stream_stdout();
+}
+
+void* io_read_line(void** args){
+    return stream_read_line(args[0]);
+}
+
+void* io_read_chunk(void** args){
+    return stream_read_chunk(args[0], (int)(long)args[1]);
+}
+
+void* io_read_all(void** args){
+    return stream_read_all(args[0]);
+}
+
+void* io_write(void** args){
+    char* str = args[1];
+    if (str == NULL)
+        stream_write(args[0], "null", 4);
+    else
+        stream_write(args[0], str, string_length(str));
+    return args[0];
+}
+
+void* io_write_line(void** args){
+    io_write(args);
+    stream_write(args[0], "\n", 1);
+    return args[0];
+}
+
+void* io_write_int(void** args){
+    char buffer[16];
+    int length = snprintf(buffer, sizeof(buffer), "%d", (int)(long)args[1]);
+    stream_write(args[0], buffer, length);
+    return args[0];
+}
 
+void* io_write_view(void** args){
+    View* view = args[1];
+    stream_write(args[0], view->chars, view->length);
+    return args[0];
+}
+
+void* io_flush(void** args){
+    stream_flush(args[0]);
+    return args[0];
+}
+
+void* io_close(void** args){
+    stream_close(args[0]);
+    return NULL;
+}
+
+void* view_length(void** args){
+    return (void*)(long)((View*)args[0])->length;
+}
+
+void* view_byte_at(void** args){
+    View* view = args[0];
+    long idx = (int)(long)args[1];
+    if (idx < 0 || idx >= view->length)
+        return (void*)(long)-1;
+    return (void*)(long)(u_int8_t)view->chars[idx];
+}
+
+void* view_slice(void** args){
+    View* view = args[0];
+    long begin = (int)(long)args[1];
+    long end = (int)(long)args[2];
+    if (begin < 0) begin = 0;
+    if (end > view->length) end = view->length;
+    if (end < begin) end = begin;
+    return view_new(view->chars + begin, end - begin);
+}
+
+void* view_find(void** args){
+    View* view = args[0];
+    long from = (int)(long)args[2];
+    if (from < 0) from = 0;
+    if (from >= view->length)
+        return (void*)(long)-1;
+    char* found = memchr(view->chars + from, (int)(long)args[1], view->length - from);
+    return (void*)(long)(found == NULL ? -1 : found - view->chars);
+}
+
+void* view_string(void** args){
+    View* view = args[0];
+    return string_new(view->chars, (int) view->length);
+}
+
+void* view_release(void** args){
+    view_free(args[0]);
+    return NULL;
+}
 
+void* view_to_int(void** args){
+    View* view = args[0];
+    long i = 0;
+    int sign = 1;
+    long value = 0;
+    if (i < view->length && (view->chars[i] == '-' || view->chars[i] == '+'))
+        sign = view->chars[i++] == '-' ? -1 : 1;
+    /* saturates like the conversions to int */
+    for (; i < view->length && view->chars[i] >= '0' && view->chars[i] <= '9'; i++){
+        value = value * 10 + (view->chars[i] - '0');
+        if (value > 2147483648L) value = 2147483648L;
+    }
+    value *= sign;
+    if (value > 2147483647L) value = 2147483647L;
+    return (void*)value;
+}
 
+void* view_equals(void** args){
+    View* view = args[0];
+    char* str = args[1];
+    return (void*)(long)(str != NULL && string_length(str) == view->length
+            && memcmp(view->chars, str, view->length) == 0);
+}
 
 
+static RNI_Entry natives[] = {
+        {"println",         1, println,         0},
+        {"str_length",      1, str_length,      1},
+        {"str_hash",        1, str_hash,        1},
+        {"str_concat",      2, str_concat,      3},
+        {"str_substring",   3, str_substring,   1},
+        {"str_index_of",    2, str_index_of,    3},
+        {"str_char_at",     2, str_char_at,     1},
+        {"str_from_int",    1, str_from_int,    0},
+        {"str_to_int",      1, str_to_int,      1},
+        {"str_from_long",   1, str_from_long,   0},
+        {"str_from_double", 1, str_from_double, 0},
+        {"str_equals",      2, str_equals,      0},
+        {"str_intern",      1, str_intern,      1},
+        {"str_free",        1, str_release,     1},
+        {"sb_new",          0, sb_new,          0},
+        {"sb_append",       2, sb_append,       1},
+        {"sb_append_int",   2, sb_append_int,   1},
+        {"sb_build",        1, sb_build,        1},
+        {"sb_free",         1, sb_release,      1},
+        {"map_new",         0, map_create,      0},
+        {"map_put",         3, map_set,         1},
+        {"map_get",         2, map_lookup,      1},
+        {"map_has",         2, map_has,         1},
+        {"map_remove",      2, map_delete,      1},
+        {"map_size",        1, map_length,      1},
+        {"map_iter",        1, map_iter,        1},
+        {"map_next",        2, map_iter_next,   1},
+        {"map_key",         2, map_key,         1},
+        {"map_value",       2, map_value,       1},
+        {"map_keys",        1, map_keys,        1},
+        {"map_values",      1, map_values,      1},
+        {"map_from_arrays", 2, map_from_arrays, 3},
+        {"map_free",        1, map_release,     1},
+        {"io_open",         2, io_open,         3},
+        {"io_stdin",        0, io_stdin,        0},
+        {"io_stdout",       0, io_stdout,       0},
+        {"io_read_line",    1, io_read_line,    1},
+        {"io_read_chunk",   2, io_read_chunk,   1},
+        {"io_read_all",     1, io_read_all,     1},
+        {"io_write",        2, io_write,        1},
+        {"io_write_line",   2, io_write_line,   1},
+        {"io_write_int",    2, io_write_int,    1},
+        {"io_write_view",   2, io_write_view,   3},
+        {"io_flush",        1, io_flush,        1},
+        {"io_close",        1, io_close,        1},
+        {"view_length",     1, view_length,     1},
+        {"view_byte_at",    2, view_byte_at,    1},
+        {"view_slice",      3, view_slice,      1},
+        {"view_find",       3, view_find,       1},
+        {"view_string",     1, view_string,     1},
+        {"view_to_int",     1, view_to_int,     1},
+        {"view_equals",     2, view_equals,     1},
+        {"view_free",       1, view_release,    1},
+};
 
+#define NATIVES_COUNT (sizeof(natives) / sizeof(RNI_Entry))
 
 
 bool string_equals(char* given, char* expected){
     return strcmp(given, expected) == 0;
 }
 
+RNI_Entry* find_native(char* name){
+    for (size_t i = 0; i < NATIVES_COUNT; i++){
+        if (string_equals(name, natives[i].name))
+            return &natives[i];
+    }
+    return NULL;
+}
+
+RNI_Entry* rni_lookup(char* name){
+    RNI_Entry* entry = find_native(name);
+    if (entry != NULL)
+        return entry;
+
+    fprintf(stderr, "%s%s%s", "can not find native function '", name, "'");
+    exit(-1);
+}
+
 int rni_argc_of(char* name){
-    if(string_equals(name, "println"))
-        return 1;
+    RNI_Entry* entry = find_native(name);
+    if (entry != NULL)
+        return entry->argc;
 
     fprintf(stderr, "%s%s%s", "can not find native function '", name, "'");
     exit(-1);
 }
 
 void* rni_invoke(char* name, void** args){
-
-    if(string_equals(name, "println"))
-        return println(args[0]);
+    RNI_Entry* entry = find_native(name);
+    if (entry != NULL)
+        return entry->function(args);
 
     /* should never happen */
     error("assertion error: should never happen -> native function not found");
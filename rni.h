@@ -1,4 +1,13 @@
 
+typedef struct rni_entry {
+    char* name;
+    int argc;
+    void* (*function)(void** args);
+    int non_null; /* bit i set: argument i must not be null */
+} RNI_Entry;
+
+RNI_Entry* rni_lookup(char* name);
+
 int rni_argc_of(char* name);
 
 void* rni_invoke(char* name, void** args);
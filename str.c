@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "utils.h"
+#include "str.h"
+
+#define INITIAL_TABLE_SIZE 64
+
+typedef struct string_table {
+    int size;
+    int capacity;
+    R_String** entries;
+} String_Table;
+
+static String_Table table = {0, 0, NULL};
+
+/* parallel workers intern strings concurrently */
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+unsigned int hash_chars(const char* chars, int length){
+    /* FNV-1a */
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < length; i++){
+        hash ^= (u_int8_t) chars[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void grow_table(){
+    int old_capacity = table.capacity;
+    R_String** old_entries = table.entries;
+
+    table.capacity = old_capacity == 0 ? INITIAL_TABLE_SIZE : old_capacity * 2;
+    table.entries = calloc(table.capacity, sizeof(R_String*));
+
+    for (int i = 0; i < old_capacity; i++){
+        R_String* entry = old_entries[i];
+        if (entry == NULL) continue;
+        int idx = (int)(entry->hash & (table.capacity - 1));
+        while (table.entries[idx] != NULL) idx = (idx + 1) & (table.capacity - 1);
+        table.entries[idx] = entry;
+    }
+    free(old_entries);
+}
+
+char* intern_string(const char* chars, int length){
+    pthread_mutex_lock(&table_lock);
+    if (table.size * 2 >= table.capacity) grow_table();
+
+    unsigned int hash = hash_chars(chars, length);
+    int idx = (int)(hash & (table.capacity - 1));
+
+    R_String* entry;
+    while ((entry = table.entries[idx]) != NULL){
+        if (entry->hash == hash && entry->length == length && memcmp(entry->chars, chars, length) == 0){
+            pthread_mutex_unlock(&table_lock);
+            return entry->chars;
+        }
+        idx = (idx + 1) & (table.capacity - 1);
+    }
+
+    entry = string_header(string_new(chars, length));
+    entry->hash = hash;
+    entry->hashed = 1;
+    entry->interned = 1;
+
+    table.entries[idx] = entry;
+    table.size++;
+    pthread_mutex_unlock(&table_lock);
+    return entry->chars;
+}
+
+char* intern_c_string(const char* chars){
+    return intern_string(chars, (int) strlen(chars));
+}
+
+R_String* new_r_string(int length){
+    R_String* str = malloc(sizeof(R_String) + length + 1);
+    note_allocation(sizeof(R_String) + length + 1);
+    str->length = length;
+    str->hash = 0;
+    str->hashed = 0;
+    str->interned = 0;
+    str->chars[length] = '\0';
+    return str;
+}
+
+char* string_new(const char* chars, int length){
+    R_String* str = new_r_string(length);
+    memcpy(str->chars, chars, length);
+    return str->chars;
+}
+
+char* string_intern(char* str){
+    if (string_header(str)->interned) return str;
+    return intern_string(str, string_length(str));
+}
+
+void string_free(char* str){
+    if (!string_header(str)->interned)
+        free(string_header(str));
+}
+
+/* malloc aligns every block it hands out, so the chars of a string never sit on a block start */
+_Static_assert(offsetof(R_String, chars) % _Alignof(max_align_t) != 0, "string chars must not be malloc aligned");
+
+int is_string(void* ptr){
+    return (unsigned long) ptr % _Alignof(max_align_t) == offsetof(R_String, chars) % _Alignof(max_align_t);
+}
+
+R_String* string_header(char* str){
+    return (R_String*)(str - offsetof(R_String, chars));
+}
+
+int string_length(char* str){
+    return string_header(str)->length;
+}
+
+unsigned int string_hash(char* str){
+    R_String* header = string_header(str);
+    /* parallel workers may hash a shared string at the same time, they store the same value */
+    if (!__atomic_load_n(&header->hashed, __ATOMIC_ACQUIRE)){
+        __atomic_store_n(&header->hash, hash_chars(str, header->length), __ATOMIC_RELAXED);
+        __atomic_store_n(&header->hashed, 1, __ATOMIC_RELEASE);
+    }
+    return __atomic_load_n(&header->hash, __ATOMIC_RELAXED);
+}
+
+int string_content_equals(char* left, char* right){
+    if (left == right) return 1;
+    R_String* l = string_header(left);
+    R_String* r = string_header(right);
+    return l->length == r->length && memcmp(l->chars, r->chars, l->length) == 0;
+}
+
+char* string_concat(char* left, char* right){
+    R_String* l = string_header(left);
+    R_String* r = string_header(right);
+    R_String* str = new_r_string(l->length + r->length);
+    memcpy(str->chars, l->chars, l->length);
+    memcpy(str->chars + l->length, r->chars, r->length);
+    return str->chars;
+}
+
+char* string_substring(char* str, int begin, int end){
+    int length = string_length(str);
+    if (begin < 0) begin = 0;
+    if (end > length) end = length;
+    if (end < begin) end = begin;
+    return string_new(str + begin, end - begin);
+}
+
+int string_index_of(char* str, char* sub){
+    char* found = strstr(str, sub);
+    return found == NULL ? -1 : (int)(found - str);
+}
+
+char* string_from_int(int value){
+    char buffer[16];
+    int length = snprintf(buffer, sizeof(buffer), "%d", value);
+    return string_new(buffer, length);
+}
+
+
+String_Builder* builder_new(){
+    String_Builder* builder = malloc(sizeof(String_Builder));
+    builder->length = 0;
+    builder->capacity = 16;
+    builder->buffer = malloc(builder->capacity);
+    note_allocation(sizeof(String_Builder) + builder->capacity);
+    return builder;
+}
+
+void builder_append(String_Builder* builder, const char* chars, int length){
+    if (builder->length + length > builder->capacity){
+        int old_capacity = builder->capacity;
+        while (builder->length + length > builder->capacity) builder->capacity *= 2;
+        builder->buffer = realloc(builder->buffer, builder->capacity);
+        note_allocation(builder->capacity - old_capacity);
+    }
+    memcpy(builder->buffer + builder->length, chars, length);
+    builder->length += length;
+}
+
+char* builder_build(String_Builder* builder){
+    return string_new(builder->buffer, builder->length);
+}
+
+void builder_free(String_Builder* builder){
+    free(builder->buffer);
+    free(builder);
+}
+
+
+void free_strings(){
+    for (int i = 0; i < table.capacity; i++){
+        if (table.entries[i] != NULL)
+            free(table.entries[i]);
+    }
+    free(table.entries);
+    table.entries = NULL;
+    table.size = 0;
+    table.capacity = 0;
+}
@@ -0,0 +1,64 @@
+#include <stdlib.h>
+
+/*
+ * Strings are immutable: every string value the VM hands out is the 'chars'
+ * member of a R_String, so it can still be used as a plain char*. Pool constants
+ * are interned, so equal constants share one address and EQUALS on them is a
+ * pointer comparison. Strings made at runtime are ordinary heap objects: they are
+ * compared with str_equals, interned on request with str_intern and released
+ * with str_free. The hash is computed the first time it is asked for.
+ */
+typedef struct r_string {
+    int length;
+    unsigned int hash;
+    u_int8_t hashed;
+    u_int8_t interned;
+    char chars[];
+} R_String;
+
+typedef struct string_builder {
+    int length;
+    int capacity;
+    char* buffer;
+} String_Builder;
+
+char* intern_string(const char* chars, int length);
+
+char* intern_c_string(const char* chars);
+
+char* string_new(const char* chars, int length);
+
+char* string_intern(char* str);
+
+/* interned strings belong to the table and are left alone */
+void string_free(char* str);
+
+int string_content_equals(char* left, char* right);
+
+/* tells a string apart from an object, both of which are heap values */
+int is_string(void* ptr);
+
+R_String* string_header(char* str);
+
+int string_length(char* str);
+
+unsigned int string_hash(char* str);
+
+char* string_concat(char* left, char* right);
+
+char* string_substring(char* str, int begin, int end);
+
+int string_index_of(char* str, char* sub);
+
+char* string_from_int(int value);
+
+String_Builder* builder_new();
+
+void builder_append(String_Builder* builder, const char* chars, int length);
+
+/* the builder stays usable until it is freed */
+char* builder_build(String_Builder* builder);
+
+void builder_free(String_Builder* builder);
+
+void free_strings();
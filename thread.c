@@ -2,102 +2,276 @@
 #include "utils.h"
 #include "stdio.h"
 #include "rni.h"
+#include "trace.h"
+#include "profile.h"
+#include "opcodes.h"
+#include "str.h"
+#include "debug.h"
+#include "parallel.h"
+#include "verify.h"
 #include <string.h>
 
 #define MAX_RECURSION_LIMIT 300000
 
-static char* ARRAY_NAME = "arr";
-
-enum Opcode {
-    PUSH_NULL,
-    PUSH_INT,
-    LOAD_CONST,
-
-    LOAD_LOCAl,
-    STORE_LOCAL,
-
-    NEW,
-    FREE,
-    NULL_CHECK,
-    CHECK_CAST,
-    I2F,
-    F2I,
-
-    MAKE_ARRAY,
-    READ_ARRAY,
-    WRITE_ARRAY,
-
-    GET_FIELD,
-    PUT_FIELD,
-
-    INVOKE_VIRTUAL,
-    INVOKE_TEMPLATE,
-    INVOKE_NATIVE,
-    RETURN,
-
-    DUP,
-    SWAP,
-    POP,
-
-    NOT,
-    NEG,
-
-    ADD_I,
-    SUB_I,
-    MUL_I,
-    MOD,
-    AND,
-    OR,
-    AND_BIT,
-    OR_BIT,
-    XOR,
-    SHIFT_AL,
-    SHIFT_AR,
-    ADD_F,
-    SUB_F,
-    MUL_F,
-    DIV,
-    EQUALS,
-    NOT_EQUALS,
-    LESS,
-    GREATER,
-    LESS_EQ,
-    GREATER_EQ,
-
-
-    GOTO,
-    BRANCH_NOT_ZERO,
-    BRANCH_ZERO,
-
-    NEW_LINE,
 
-};
+void account_alloc(Context* ctx, void* ptr, char* name, long bytes){
+    Trace* trace = get_trace(ctx);
+    if (trace != NULL)
+        trace_event(trace, TRACE_ALLOC, name, bytes);
 
+    Heap_Profile* profile = get_heap_profile(ctx);
+    if (profile != NULL)
+        profile_alloc(profile, ptr, name, bytes, curr_func_name(ctx), get_curr_line(ctx));
+}
 
 void new_obj(Context* ctx, int addr){
     Type* type = get_pool_value(ctx, addr);
-    R_Object * obj = malloc(sizeof(R_Object));
+    long bytes = sizeof(R_Object) + type->bytes;
+    charge_memory(ctx, bytes);
+    R_Object * obj = malloc(bytes);
     obj->type = type;
-    obj->content = malloc(sizeof(void*) * type->size);
+    obj->content = (void**)(obj + 1);
+    account_alloc(ctx, obj, type->name, bytes);
     op_stack_push(ctx, obj);
 }
 
+/* runtime errors are thrown as objects holding message, function name and line */
+enum Runtime_Error {
+    NULL_POINTER_ERROR,
+    INDEX_ERROR,
+    CAST_ERROR,
+    METHOD_ERROR,
+    NATIVE_ERROR,
+    RECURSION_ERROR,
+    ARITHMETIC_ERROR,
+};
+
+static Type ERROR_TYPES[] = {
+        {.size = 3, .name = "NullPointerError"},
+        {.size = 3, .name = "IndexOutOfBoundsError"},
+        {.size = 3, .name = "CastError"},
+        {.size = 3, .name = "NoSuchMethodError"},
+        {.size = 3, .name = "NativeError"},
+        {.size = 3, .name = "StackOverflowError"},
+        {.size = 3, .name = "ArithmeticError"},
+};
+
+#define ERROR_TYPES_COUNT (sizeof(ERROR_TYPES) / sizeof(Type))
+
+bool is_runtime_error(Type* type){
+    return type >= ERROR_TYPES && type < ERROR_TYPES + ERROR_TYPES_COUNT;
+}
+
+Handler* find_handler(V_Function* function, int ip, Type* type){
+    for (int i = 0; i < function->handler_count; i++){
+        Handler* handler = &function->handlers[i];
+        if (ip < handler->start || ip >= handler->end) continue;
+        if (handler->type == NULL || handler->type == type || strcmp(handler->type->name, type->name) == 0)
+            return handler;
+    }
+    return NULL;
+}
+
+void report_uncaught(R_Object* exception, char* func_name, int line){
+    if (is_runtime_error(exception->type))
+        fprintf(stderr, "%s%s%s%s%d%s", (char*) exception->content[0],
+                " (in ", (char*) exception->content[1], ": line ", (int)(long) exception->content[2], ")");
+    else
+        fprintf(stderr, "%s%s%s%s%s%d%s", "uncaught ", exception->type->name,
+                " (in ", func_name, ": line ", line, ")");
+}
+
+/*
+ * Handler tables are only consulted here, so code that does not throw pays
+ * nothing for them. Frames are popped until one covers the current instruction,
+ * then the interpreter loop is resumed at the handler.
+ */
+void throw_exception(Context* ctx, R_Object* exception){
+    char* func_name = curr_func_name(ctx);
+    int line = get_curr_line(ctx);
+
+    while (!frame_stack_is_empty(ctx)){
+        Handler* handler = find_handler(curr_function(ctx), curr_instruction(ctx), exception->type);
+        if (handler != NULL){
+            clear_op_stack(ctx);
+            op_stack_push(ctx, exception);
+            jump_to(ctx, handler->target);
+            longjmp(*get_unwind_target(ctx), 1);
+        }
+        pop_frame(ctx);
+    }
+
+    if (is_worker(ctx))
+        fail_worker(ctx, exception);
+
+    report_uncaught(exception, func_name, line);
+    clean_up(ctx);
+    exit(-1);
+}
+
+void raise_error(Context* ctx, int kind, char* message){
+    Type* type = &ERROR_TYPES[kind];
+    long bytes = sizeof(R_Object) + sizeof(void*) * type->size;
+    R_Object* error = malloc(bytes);
+    error->type = type;
+    error->content = (void**)(error + 1);
+    error->content[0] = string_new(message, (int) strlen(message));
+    error->content[1] = intern_c_string(curr_func_name(ctx));
+    error->content[2] = (void*)(long) get_curr_line(ctx);
+    account_alloc(ctx, error, type->name, bytes);
+    throw_exception(ctx, error);
+}
+
+void throw_op(Context* ctx){
+    R_Object* exception = op_stack_pop(ctx);
+    if (exception == NULL)
+        raise_error(ctx, NULL_POINTER_ERROR, "null pointer error");
+    throw_exception(ctx, exception);
+}
+
+void* read_packed(R_Object* obj, int addr){
+    char* field = (char*) obj->content + obj->type->offsets[addr];
+    switch (obj->type->kinds[addr]) {
+        case FIELD_I8:
+            return (void*)(long) *(int8_t*) field;
+        case FIELD_I32:
+        case FIELD_F32:
+            return (void*)(long) *(int32_t*) field;
+        default:
+            return *(void**) field;
+    }
+}
+
+void write_packed(R_Object* obj, int addr, void* value){
+    char* field = (char*) obj->content + obj->type->offsets[addr];
+    switch (obj->type->kinds[addr]) {
+        case FIELD_I8:
+            *(int8_t*) field = (int8_t)(long) value;
+            break;
+        case FIELD_I32:
+        case FIELD_F32:
+            *(int32_t*) field = (int32_t)(long) value;
+            break;
+        default:
+            *(void**) field = value;
+    }
+}
+
+void check_field(Context* ctx, R_Object* obj, int addr){
+    if (addr >= obj->type->size){
+        char message[256];
+        snprintf(message, sizeof(message), "%s%d%s%s", "no field ", addr, " in ", obj->type->name);
+        raise_error(ctx, INDEX_ERROR, message);
+    }
+}
+
+/* typed accesses skip the dispatch on the field kind once it is checked */
+void check_field_kind(Context* ctx, R_Object* obj, int addr, u_int8_t kind){
+    check_field(ctx, obj, addr);
+    if (obj->type->kinds == NULL || obj->type->kinds[addr] != kind){
+        char message[256];
+        snprintf(message, sizeof(message), "%s%d%s%s%s", "field ", addr, " of ", obj->type->name, " has another kind");
+        raise_error(ctx, CAST_ERROR, message);
+    }
+}
+
 void get_field(Context* ctx, int addr){
     R_Object* obj = op_stack_pop(ctx);
-    op_stack_push(ctx, obj->content[addr]);
+    if (obj->type->kinds == NULL){
+        op_stack_push(ctx, obj->content[addr]);
+        return;
+    }
+    check_field(ctx, obj, addr);
+    op_stack_push(ctx, read_packed(obj, addr));
 }
 
 void put_field(Context* ctx, int addr){
     R_Object* obj = op_stack_pop(ctx);
     void* value = op_stack_pop(ctx);
-    obj->content[addr] = value;
+    if (obj->type->kinds == NULL){
+        obj->content[addr] = value;
+        return;
+    }
+    check_field(ctx, obj, addr);
+    write_packed(obj, addr, value);
+}
+
+/*
+ * The kind of a field is fixed per type, so the first typed access replaces
+ * itself with a variant that only compares the object's type with the one it
+ * checked; objects of another type take the full check again.
+ */
+void quicken_field(Context* ctx, u_int8_t opcode, R_Object* obj, int addr, u_int8_t kind){
+    if (!may_rewrite(ctx)) return;
+    Field_Inst* quick = malloc(sizeof(Field_Inst));
+    quick->opcode = opcode;
+    quick->addr = addr;
+    quick->kind = kind;
+    quick->offset = obj->type->offsets[addr];
+    quick->type = obj->type;
+    rewrite_instruction(ctx, (u_int8_t*) quick);
+}
+
+char* typed_field(Context* ctx, R_Object* obj, Field_Inst* inst){
+    if (obj->type != inst->type){
+        check_field_kind(ctx, obj, inst->addr, inst->kind);
+        return (char*) obj->content + obj->type->offsets[inst->addr];
+    }
+    return (char*) obj->content + inst->offset;
+}
+
+void get_field_i8(Context* ctx, int addr){
+    R_Object* obj = op_stack_pop(ctx);
+    check_field_kind(ctx, obj, addr, FIELD_I8);
+    op_stack_push(ctx, (void*)(long) *(int8_t*)((char*) obj->content + obj->type->offsets[addr]));
+    quicken_field(ctx, GET_FIELD_I8_RESOLVED, obj, addr, FIELD_I8);
+}
+
+void get_field_i32(Context* ctx, int addr, u_int8_t kind){
+    R_Object* obj = op_stack_pop(ctx);
+    check_field_kind(ctx, obj, addr, kind);
+    op_stack_push(ctx, (void*)(long) *(int32_t*)((char*) obj->content + obj->type->offsets[addr]));
+    quicken_field(ctx, GET_FIELD_I32_RESOLVED, obj, addr, kind);
+}
+
+void put_field_i8(Context* ctx, int addr){
+    R_Object* obj = op_stack_pop(ctx);
+    check_field_kind(ctx, obj, addr, FIELD_I8);
+    *(int8_t*)((char*) obj->content + obj->type->offsets[addr]) = (int8_t)(long) op_stack_pop(ctx);
+    quicken_field(ctx, PUT_FIELD_I8_RESOLVED, obj, addr, FIELD_I8);
+}
+
+void put_field_i32(Context* ctx, int addr, u_int8_t kind){
+    R_Object* obj = op_stack_pop(ctx);
+    check_field_kind(ctx, obj, addr, kind);
+    *(int32_t*)((char*) obj->content + obj->type->offsets[addr]) = (int32_t)(long) op_stack_pop(ctx);
+    quicken_field(ctx, PUT_FIELD_I32_RESOLVED, obj, addr, kind);
+}
+
+void get_field_i8_resolved(Context* ctx, Field_Inst* inst){
+    R_Object* obj = op_stack_pop(ctx);
+    op_stack_push(ctx, (void*)(long) *(int8_t*) typed_field(ctx, obj, inst));
+}
+
+void get_field_i32_resolved(Context* ctx, Field_Inst* inst){
+    R_Object* obj = op_stack_pop(ctx);
+    op_stack_push(ctx, (void*)(long) *(int32_t*) typed_field(ctx, obj, inst));
+}
+
+void put_field_i8_resolved(Context* ctx, Field_Inst* inst){
+    R_Object* obj = op_stack_pop(ctx);
+    *(int8_t*) typed_field(ctx, obj, inst) = (int8_t)(long) op_stack_pop(ctx);
+}
+
+void put_field_i32_resolved(Context* ctx, Field_Inst* inst){
+    R_Object* obj = op_stack_pop(ctx);
+    *(int32_t*) typed_field(ctx, obj, inst) = (int32_t)(long) op_stack_pop(ctx);
 }
 
 void report_cast_failed(Context* ctx, Type* req, Type* giv){
-    fprintf(stderr, "%s%s%s%s%s%s%s%d%s",
-            "can not cast ", giv->name, " to ", req->name, " (in ", curr_func_name(ctx), ": line ", get_curr_line(ctx), ")");
-    clean_up(ctx);
-    exit(-1);
+    char message[256];
+    snprintf(message, sizeof(message), "%s%s%s%s", "can not cast ", giv->name, " to ", req->name);
+    raise_error(ctx, CAST_ERROR, message);
 }
 
 void check_cast(Context* ctx, int addr){
@@ -118,11 +292,8 @@ void check_cast(Context* ctx, int addr){
 
 void null_check(Context* ctx){
     void* value = op_stack_pop(ctx);
-    if (value == NULL) {
-        fprintf(stderr, "%s%s%s%d%s", "null pointer error (in ", curr_func_name(ctx), ": line ", get_curr_line(ctx), ")");
-        clean_up(ctx);
-        exit(-1);
-    }
+    if (value == NULL)
+        raise_error(ctx, NULL_POINTER_ERROR, "null pointer error");
     op_stack_push(ctx, value);
 }
 
@@ -140,33 +311,26 @@ void swap(Context* ctx){
 }
 
 
-void invoke_virtual(Context* ctx, u_int8_t pool_addr, int argc) {
-    if(get_frame_stack_size(ctx) == MAX_RECURSION_LIMIT){
-        fprintf(stderr, "%s%s%s%d%s",
-                "too many recursions (in ", curr_func_name(ctx), ": line ", get_curr_line(ctx), ")");
-        clean_up(ctx);
-        exit(-1);
-    }
-    V_Function* v_func = get_pool_value(ctx, pool_addr);
+void invoke_function(Context* ctx, V_Function* v_func, int argc){
+    if(get_frame_stack_size(ctx) == MAX_RECURSION_LIMIT)
+        raise_error(ctx, RECURSION_ERROR, "too many recursions");
+    charge_budget(ctx, 1);
     void* args[argc];
     for (int i = 0; i < argc; i++) args[i] = op_stack_pop(ctx);
-    push_frame(ctx, v_func->name, v_func->locals, v_func->op_stack, v_func->instructions);
+    push_frame(ctx, v_func);
     for (int i = argc-1; i >= 0; i--) op_stack_push(ctx, args[i]);
 }
 
+void invoke_virtual(Context* ctx, u_int8_t pool_addr, int argc) {
+    invoke_function(ctx, get_function(ctx, pool_addr), argc);
+}
+
 void invoke_template(Context* ctx, u_int8_t pool_addr, int argc){
     char* name = get_pool_value(ctx, pool_addr);
     R_Object* obj = op_stack_pop(ctx);
     Type* type = obj->type;
-    if(type->v_methods == NULL) {
-        fprintf(stderr, "%s%s%s%s%s%d%s",
-                "can not find implementation of '", name, "' (in ", type->name, ": line ",get_curr_line(ctx), ")");
-        clean_up(ctx);
-        exit(-1);
-    }
-
     int addr = -1;
-    for (int i = 0; i < type->v_methods->size; i++){
+    for (int i = 0; type->v_methods != NULL && i < type->v_methods->size; i++){
         if (strcmp(name, type->v_methods->names[i]) == 0){
             addr = type->v_methods->addresses[i];
             break;
@@ -174,64 +338,76 @@ void invoke_template(Context* ctx, u_int8_t pool_addr, int argc){
     }
 
     if(addr == -1) {
-        fprintf(stderr, "%s%s%s%s%s%d%s",
-                "can not find implementation of '", name, "' (in ", type->name, ": line ",get_curr_line(ctx), ")");
-        clean_up(ctx);
-        exit(-1);
+        char message[256];
+        snprintf(message, sizeof(message), "%s%s%s%s", "can not find implementation of '", name, "' in ", type->name);
+        raise_error(ctx, METHOD_ERROR, message);
     }
 
     invoke_virtual(ctx, addr, argc);
 }
 
-void invoke_native(Context* ctx, u_int8_t pool_addr, int argc) {
+RNI_Entry* resolve_native(Context* ctx, u_int8_t pool_addr, int argc){
     char* name = get_pool_value(ctx, pool_addr);
-    int req_argc = rni_argc_of(name);
-    if (argc != req_argc){
-        fprintf(stderr, "%s%s%s%s%s", "invalid argument count for native function '", name, "' (in ", curr_func_name(ctx), ")");
-        clean_up(ctx);
-        exit(-1);
+    RNI_Entry* native = rni_lookup(name);
+    if (argc != native->argc){
+        char message[256];
+        snprintf(message, sizeof(message), "%s%s%s", "invalid argument count for native function '", name, "'");
+        raise_error(ctx, NATIVE_ERROR, message);
     }
+    return native;
+}
+
+void call_native(Context* ctx, RNI_Entry* native, int argc){
     void* args[argc];
-    for (int  i = 0; i < argc; i++) args[i] = op_stack_pop(ctx);
-    void* res = rni_invoke(name, args);
+    for (int i = argc-1; i >= 0; i--) args[i] = op_stack_pop(ctx);
+    for (int i = 0; i < argc; i++){
+        if (args[i] == NULL && (native->non_null & (1 << i))){
+            char message[256];
+            snprintf(message, sizeof(message), "%s%s%s", "null argument to native function '", native->name, "'");
+            raise_error(ctx, NULL_POINTER_ERROR, message);
+        }
+    }
+    Trace* trace = get_trace(ctx);
+    long start = trace == NULL ? 0 : trace_now();
+    long allocated = allocated_bytes();
+    void* res = native->function(args);
+    if (trace != NULL)
+        trace_event(trace, TRACE_NATIVE, native->name, start);
+    /* natives have no context, they are charged for what the runtime helpers allocated for them */
+    if (allocated_bytes() != allocated)
+        charge_memory(ctx, allocated_bytes() - allocated);
     op_stack_push(ctx, res);
 }
 
+void invoke_native(Context* ctx, u_int8_t pool_addr, int argc) {
+    call_native(ctx, resolve_native(ctx, pool_addr, argc), argc);
+}
+
 void return_virtual(Context* ctx){
     void* return_value = op_stack_pop(ctx);
     pop_frame(ctx);
     if (!frame_stack_is_empty(ctx))
         op_stack_push(ctx, return_value);
+    else
+        set_result(ctx, return_value);
 }
 
 
-Type* make_array_type(){
-    Type* type = malloc(sizeof(Type));
-    type->name = ARRAY_NAME;
-    type->v_methods = NULL;
-    type->size = 0;
-    return type;
-}
-
 void make_array(Context* ctx, int size){
-    R_Object* arr = malloc(sizeof(R_Object));
-
-    arr->content = malloc(sizeof(size+1));
-    arr->type = make_array_type();
-    arr->content[0] = (void*)(long)size;
+    charge_memory(ctx, sizeof(R_Object) + sizeof(void*) * (size+1));
+    R_Object* arr = new_array(size);
     for (int  i = 0; i < size; i++){
         arr->content[i+1] = op_stack_pop(ctx);
     }
+    account_alloc(ctx, arr, arr->type->name, sizeof(R_Object) + sizeof(void*) * (size+1));
     op_stack_push(ctx, arr);
 }
 
 void check_bounds(Context* ctx, int idx, int size){
     if(idx < 0 || idx >= size){
-        fprintf(stderr, "%s%d%s%d%s%s%s%d%s",
-                "index ", idx, " out of bounds for array length ", size,
-                " (in ", curr_func_name(ctx), ": line ", get_curr_line(ctx), ")");
-        clean_up(ctx);
-        exit(-1);
+        char message[128];
+        snprintf(message, sizeof(message), "%s%d%s%d", "index ", idx, " out of bounds for array length ", size);
+        raise_error(ctx, INDEX_ERROR, message);
     }
 }
 
@@ -256,6 +432,8 @@ void load_const(Context* ctx, u_int8_t addr){
         case 0:
         case 1:
         case 2:
+        case 7:
+        case 8:
             op_stack_push(ctx, get_pool_value(ctx, addr));
             break;
 
@@ -264,19 +442,59 @@ void load_const(Context* ctx, u_int8_t addr){
     }
 }
 
+/* every loop passes a backward branch, so only those are charged against the budget */
+void jump(Context* ctx, int address){
+    int ip = curr_instruction(ctx);
+    if (address <= ip)
+        charge_budget(ctx, ip - address + 1);
+    jump_to(ctx, address);
+}
+
 void jump_branch(Context* ctx, int address, u_int8_t when){
     int b = ((int)(long)op_stack_pop(ctx));
-    if (b == when) jump_to(ctx, address);
+    if (b == when) jump(ctx, address);
 }
 
-int int_from_2_bytes(u_int8_t b1, u_int8_t b2){
-    return ((b1 & 0xff) << 8) | (b2 & 0xff);
+void table_switch(Context* ctx, u_int8_t* inst){
+    long idx = (long)(int)(long) op_stack_pop(ctx) - int_from_4_bytes(inst + 3);
+    if (idx < 0 || idx >= inst[7])
+        jump(ctx, int_from_2_bytes(inst[1], inst[2]));
+    else
+        jump(ctx, int_from_2_bytes(inst[8 + 2*idx], inst[9 + 2*idx]));
+}
+
+void lookup_switch(Context* ctx, u_int8_t* inst){
+    int key = (int)(long) op_stack_pop(ctx);
+    int low = 0;
+    int high = inst[3] - 1;
+    while (low <= high){
+        int mid = (low + high) / 2;
+        u_int8_t* pair = inst + 4 + 6*mid;
+        int pair_key = int_from_4_bytes(pair);
+        if (pair_key < key)
+            low = mid + 1;
+        else if (pair_key > key)
+            high = mid - 1;
+        else {
+            jump(ctx, int_from_2_bytes(pair[4], pair[5]));
+            return;
+        }
+    }
+    jump(ctx, int_from_2_bytes(inst[1], inst[2]));
 }
 
 void free_op(Context* ctx){
     void* ptr = op_stack_pop(ctx);
-    if (ptr != NULL)
-        free(ptr);
+    if (ptr == NULL) return;
+    if (is_string(ptr)){
+        string_free(ptr);
+        return;
+    }
+
+    Heap_Profile* profile = get_heap_profile(ctx);
+    if (profile != NULL)
+        profile_free(profile, ptr);
+    free(ptr);
 }
 
 
@@ -299,6 +517,140 @@ int interpret_int(float f){
     return converter.i;
 }
 
+double interpret_double(long l){
+    union {
+        long l;
+        double d;
+    } converter;
+    converter.l = l;
+    return converter.d;
+}
+
+long interpret_long(double d){
+    union {
+        long l;
+        double d;
+    } converter;
+    converter.d = d;
+    return converter.l;
+}
+
+void operate_l(Context* ctx, long (*operation_func)(long, long)){
+    long left_val = (long) op_stack_pop(ctx);
+    long right_val = (long) op_stack_pop(ctx);
+    op_stack_push(ctx, (void*) operation_func(left_val, right_val));
+}
+
+void operate_d(Context* ctx, double (*operation_func)(double, double)){
+    double left_val = interpret_double((long) op_stack_pop(ctx));
+    double right_val = interpret_double((long) op_stack_pop(ctx));
+    op_stack_push(ctx, (void*) interpret_long(operation_func(left_val, right_val)));
+}
+
+long add_l(long l1, long l2){
+    return (long)((unsigned long) l1 + (unsigned long) l2);
+}
+
+long sub_l(long l1, long l2){
+    return (long)((unsigned long) l1 - (unsigned long) l2);
+}
+
+long mul_l(long l1, long l2){
+    return (long)((unsigned long) l1 * (unsigned long) l2);
+}
+
+long and_l(long l1, long l2){
+    return l1 & l2;
+}
+
+long or_l(long l1, long l2){
+    return l1 | l2;
+}
+
+long xor_l(long l1, long l2){
+    return l1 ^ l2;
+}
+
+long shift_ll(long l1, long l2){
+    return (long)((unsigned long) l1 << (l2 & 63));
+}
+
+long shift_rl(long l1, long l2){
+    return l1 >> (l2 & 63);
+}
+
+long cmp_l(long l1, long l2){
+    return (l1 > l2) - (l1 < l2);
+}
+
+/* integer division traps on a zero divisor; the quotient overflowing wraps as in Java */
+void divide_l(Context* ctx, bool remainder){
+    long left_val = (long) op_stack_pop(ctx);
+    long right_val = (long) op_stack_pop(ctx);
+    if (right_val == 0)
+        raise_error(ctx, ARITHMETIC_ERROR, "division by zero");
+    long res;
+    if (right_val == -1)
+        res = remainder ? 0 : (long)(0UL - (unsigned long) left_val);
+    else
+        res = remainder ? left_val % right_val : left_val / right_val;
+    op_stack_push(ctx, (void*) res);
+}
+
+double add_d(double d1, double d2){
+    return d1 + d2;
+}
+
+double sub_d(double d1, double d2){
+    return d1 - d2;
+}
+
+double mul_d(double d1, double d2){
+    return d1 * d2;
+}
+
+double div_d(double d1, double d2){
+    return d1 / d2;
+}
+
+void cmp_d(Context* ctx){
+    double left_val = interpret_double((long) op_stack_pop(ctx));
+    double right_val = interpret_double((long) op_stack_pop(ctx));
+    int res = left_val < right_val ? -1 : left_val == right_val ? 0 : 1;
+    op_stack_push(ctx, (void*)(long) res);
+}
+
+/* conversions to integers saturate, NaN becomes 0 */
+long d2l(double d){
+    if (d != d) return 0;
+    if (d >= 9223372036854775807.0) return 9223372036854775807L;
+    if (d <= -9223372036854775808.0) return -9223372036854775807L - 1;
+    return (long) d;
+}
+
+int d2i(double d){
+    if (d != d) return 0;
+    if (d >= 2147483647.0) return 2147483647;
+    if (d <= -2147483648.0) return -2147483647 - 1;
+    return (int) d;
+}
+
+void convert(Context* ctx, u_int8_t opcode){
+    void* value = op_stack_pop(ctx);
+    long res;
+    switch (opcode) {
+        case I2L: res = (int)(long) value; break;
+        case L2I: res = (int)(long) value; break;
+        case I2D: res = interpret_long((double)(int)(long) value); break;
+        case D2I: res = d2i(interpret_double((long) value)); break;
+        case L2D: res = interpret_long((double)(long) value); break;
+        case D2L: res = d2l(interpret_double((long) value)); break;
+        case F2D: res = interpret_long((double) interpret_float((int)(long) value)); break;
+        default: res = interpret_int((float) interpret_double((long) value)); break;
+    }
+    op_stack_push(ctx, (void*) res);
+}
+
 void not(Context* ctx){
     int* value = op_stack_pop(ctx);
     value = (void*)(((long)value) ^ -1);
@@ -346,8 +698,112 @@ float div_f(float f1, float f2){
     return f1 / f2;
 }
 
+/*
+ * Quickening: the first execution of LOAD_CONST, INVOKE_VIRTUAL and INVOKE_NATIVE
+ * replaces the instruction with a variant carrying the resolved value, function
+ * or native entry, so later executions skip the pool and RNI lookups.
+ */
+void quicken(Context* ctx, u_int8_t opcode, int argc, void* operand){
+    if (!may_rewrite(ctx)) return;
+    Quick_Inst* quick = malloc(sizeof(Quick_Inst));
+    quick->opcode = opcode;
+    quick->argc = argc;
+    quick->operand = operand;
+    rewrite_instruction(ctx, (u_int8_t*) quick);
+}
+
+void quicken_const(Context* ctx, u_int8_t addr){
+    int tag = get_pool_tag(ctx, addr);
+    if (tag == 0 || tag == 1 || tag == 2 || tag == 7 || tag == 8)
+        quicken(ctx, PUSH_CONST, 0, get_pool_value(ctx, addr));
+    load_const(ctx, addr);
+}
+
+void quicken_invoke(Context* ctx, u_int8_t pool_addr, int argc){
+    V_Function* v_func = get_function(ctx, pool_addr);
+    quicken(ctx, INVOKE_RESOLVED, argc, v_func);
+    invoke_function(ctx, v_func, argc);
+}
+
+void quicken_native(Context* ctx, u_int8_t pool_addr, int argc){
+    RNI_Entry* native = resolve_native(ctx, pool_addr, argc);
+    quicken(ctx, INVOKE_NATIVE_RESOLVED, argc, native);
+    call_native(ctx, native, argc);
+}
+
+/* a worker's exception or exceeded budget surfaces on the thread that started the operation */
+void finish_parallel(Context* ctx){
+    R_Object* exception = get_exception(ctx);
+    int status = get_exit_status(ctx);
+    set_failure(ctx, EXEC_OK, NULL);
+    if (exception != NULL)
+        throw_exception(ctx, exception);
+    if (status != EXEC_OK)
+        abort_execution(ctx, status);
+    /* the workers drew on this context's budget */
+    charge_budget(ctx, 0);
+}
+
+R_Object* parallel_operand(Context* ctx, u_int8_t pool_addr, V_Function** function){
+    *function = get_function(ctx, pool_addr);
+    R_Object* array = op_stack_pop(ctx);
+    if (array == NULL)
+        raise_error(ctx, NULL_POINTER_ERROR, "null pointer error");
+    charge_budget(ctx, array_length(array));
+    prepare_referenced(ctx);
+    return array;
+}
+
+void par_map(Context* ctx, u_int8_t pool_addr){
+    V_Function* function;
+    R_Object* array = parallel_operand(ctx, pool_addr, &function);
+    int length = array_length(array);
+    charge_memory(ctx, sizeof(R_Object) + sizeof(void*) * (length+1));
+    R_Object* result = new_array(length);
+    par_apply(ctx, function, array->content + 1, length, result->content + 1);
+    if (has_failed(ctx))
+        free(result);
+    finish_parallel(ctx);
+    account_alloc(ctx, result, result->type->name, sizeof(R_Object) + sizeof(void*) * (length+1));
+    op_stack_push(ctx, result);
+}
+
+void par_filter(Context* ctx, u_int8_t pool_addr){
+    V_Function* function;
+    R_Object* array = parallel_operand(ctx, pool_addr, &function);
+    int length = array_length(array);
+    void** keep = malloc(sizeof(void*) * (length+1));
+    par_apply(ctx, function, array->content + 1, length, keep);
+    if (has_failed(ctx))
+        free(keep);
+    finish_parallel(ctx);
+
+    int count = 0;
+    for (int i = 0; i < length; i++)
+        if ((int)(long) keep[i] != 0) count++;
+
+    charge_memory(ctx, sizeof(R_Object) + sizeof(void*) * (count+1));
+    R_Object* result = new_array(count);
+    for (int i = 0, j = 1; i < length; i++)
+        if ((int)(long) keep[i] != 0) result->content[j++] = array->content[i+1];
+    free(keep);
+    account_alloc(ctx, result, result->type->name, sizeof(R_Object) + sizeof(void*) * (count+1));
+    op_stack_push(ctx, result);
+}
+
+void par_fold(Context* ctx, u_int8_t pool_addr){
+    V_Function* function;
+    R_Object* array = parallel_operand(ctx, pool_addr, &function);
+    void* init = op_stack_pop(ctx);
+    void* result = par_reduce(ctx, function, array->content + 1, array_length(array), init);
+    finish_parallel(ctx);
+    op_stack_push(ctx, result);
+}
+
 void decode_and_execute(Context* ctx, u_int8_t* inst){
     u_int8_t opc = inst[0];
+    /* the left operand of a binary operation is on top of the stack */
+    int left;
 
     switch (opc) {
         case PUSH_NULL:
@@ -359,7 +815,11 @@ void decode_and_execute(Context* ctx, u_int8_t* inst){
             break;
 
         case LOAD_CONST:
-            load_const(ctx, inst[1]);
+            quicken_const(ctx, inst[1]);
+            break;
+
+        case PUSH_CONST:
+            op_stack_push(ctx, ((Quick_Inst*) inst)->operand);
             break;
 
         case LOAD_LOCAl:
@@ -414,8 +874,52 @@ void decode_and_execute(Context* ctx, u_int8_t* inst){
             put_field(ctx, inst[1]);
             break;
 
+        case GET_FIELD_I8:
+            get_field_i8(ctx, inst[1]);
+            break;
+
+        case GET_FIELD_I32:
+            get_field_i32(ctx, inst[1], FIELD_I32);
+            break;
+
+        case GET_FIELD_F32:
+            get_field_i32(ctx, inst[1], FIELD_F32);
+            break;
+
+        case PUT_FIELD_I8:
+            put_field_i8(ctx, inst[1]);
+            break;
+
+        case PUT_FIELD_I32:
+            put_field_i32(ctx, inst[1], FIELD_I32);
+            break;
+
+        case PUT_FIELD_F32:
+            put_field_i32(ctx, inst[1], FIELD_F32);
+            break;
+
+        case GET_FIELD_I8_RESOLVED:
+            get_field_i8_resolved(ctx, (Field_Inst*) inst);
+            break;
+
+        case GET_FIELD_I32_RESOLVED:
+            get_field_i32_resolved(ctx, (Field_Inst*) inst);
+            break;
+
+        case PUT_FIELD_I8_RESOLVED:
+            put_field_i8_resolved(ctx, (Field_Inst*) inst);
+            break;
+
+        case PUT_FIELD_I32_RESOLVED:
+            put_field_i32_resolved(ctx, (Field_Inst*) inst);
+            break;
+
         case INVOKE_VIRTUAL:
-            invoke_virtual(ctx, inst[1], inst[2]);
+            quicken_invoke(ctx, inst[1], inst[2]);
+            break;
+
+        case INVOKE_RESOLVED:
+            invoke_function(ctx, ((Quick_Inst*) inst)->operand, ((Quick_Inst*) inst)->argc);
             break;
 
         case INVOKE_TEMPLATE:
@@ -423,7 +927,11 @@ void decode_and_execute(Context* ctx, u_int8_t* inst){
             break;
 
         case INVOKE_NATIVE:
-            invoke_native(ctx, inst[1], inst[2]);
+            quicken_native(ctx, inst[1], inst[2]);
+            break;
+
+        case INVOKE_NATIVE_RESOLVED:
+            call_native(ctx, ((Quick_Inst*) inst)->operand, ((Quick_Inst*) inst)->argc);
             break;
 
         case RETURN:
@@ -451,7 +959,7 @@ void decode_and_execute(Context* ctx, u_int8_t* inst){
             break;
 
         case GOTO:
-            jump_to(ctx, int_from_2_bytes(inst[1], inst[2]));
+            jump(ctx, int_from_2_bytes(inst[1], inst[2]));
             break;
 
         case BRANCH_ZERO:
@@ -462,52 +970,93 @@ void decode_and_execute(Context* ctx, u_int8_t* inst){
             jump_branch(ctx, int_from_2_bytes(inst[1], inst[2]), 1);
             break;
 
+        case TABLESWITCH:
+            table_switch(ctx, inst);
+            break;
+
+        case LOOKUPSWITCH:
+            lookup_switch(ctx, inst);
+            break;
+
         case NEW_LINE:
             set_line(ctx, int_from_2_bytes(inst[1], inst[2]));
             break;
 
+        case THROW:
+            throw_op(ctx);
+            break;
+
+        case PAR_MAP:
+            par_map(ctx, inst[1]);
+            break;
+
+        case PAR_FILTER:
+            par_filter(ctx, inst[1]);
+            break;
+
+        case PAR_REDUCE:
+            par_fold(ctx, inst[1]);
+            break;
+
+        case BREAKPOINT:
+            decode_and_execute(ctx, ((Breakpoint_Inst*) inst)->original);
+            if (get_debugger(ctx) != NULL)
+                debug_stop(ctx);
+            break;
+
         case ADD_I:
-            op_stack_push(ctx, (void*)(long)(((int)(long) op_stack_pop(ctx)) + ((int)(long) op_stack_pop(ctx))));
+            left = (int)(long) op_stack_pop(ctx);
+            op_stack_push(ctx, (void*)(long)(left + (int)(long) op_stack_pop(ctx)));
             break;
 
         case SUB_I:
-            op_stack_push(ctx, (void*)(long)(((int)(long) op_stack_pop(ctx)) - ((int)(long) op_stack_pop(ctx))));
+            left = (int)(long) op_stack_pop(ctx);
+            op_stack_push(ctx, (void*)(long)(left - (int)(long) op_stack_pop(ctx)));
             break;
 
         case MOD:
-            op_stack_push(ctx, (void*)(long)(((int)(long) op_stack_pop(ctx)) % ((int)(long) op_stack_pop(ctx))));
+            left = (int)(long) op_stack_pop(ctx);
+            op_stack_push(ctx, (void*)(long)(left % (int)(long) op_stack_pop(ctx)));
             break;
 
         case MUL_I:
-            op_stack_push(ctx, (void*)(long)(((int)(long) op_stack_pop(ctx)) * ((int)(long) op_stack_pop(ctx))));
+            left = (int)(long) op_stack_pop(ctx);
+            op_stack_push(ctx, (void*)(long)(left * (int)(long) op_stack_pop(ctx)));
             break;
 
         case AND:
-            op_stack_push(ctx, (void*)(long)(((int)(long) op_stack_pop(ctx)) && ((int)(long) op_stack_pop(ctx))));
+            left = (int)(long) op_stack_pop(ctx);
+            op_stack_push(ctx, (void*)(long)((int)(long) op_stack_pop(ctx) && left));
             break;
 
         case OR:
-            op_stack_push(ctx, (void*)(long)(((int)(long) op_stack_pop(ctx)) || ((int)(long) op_stack_pop(ctx))));
+            left = (int)(long) op_stack_pop(ctx);
+            op_stack_push(ctx, (void*)(long)((int)(long) op_stack_pop(ctx) || left));
             break;
 
         case AND_BIT:
-            op_stack_push(ctx, (void*)(long)(((int)(long) op_stack_pop(ctx)) & ((int)(long) op_stack_pop(ctx))));
+            left = (int)(long) op_stack_pop(ctx);
+            op_stack_push(ctx, (void*)(long)(left & (int)(long) op_stack_pop(ctx)));
             break;
 
         case OR_BIT:
-            op_stack_push(ctx, (void*)(long)(((int)(long) op_stack_pop(ctx)) | ((int)(long) op_stack_pop(ctx))));
+            left = (int)(long) op_stack_pop(ctx);
+            op_stack_push(ctx, (void*)(long)(left | (int)(long) op_stack_pop(ctx)));
             break;
 
         case XOR:
-            op_stack_push(ctx, (void*)(long)(((int)(long) op_stack_pop(ctx)) ^ ((int)(long) op_stack_pop(ctx))));
+            left = (int)(long) op_stack_pop(ctx);
+            op_stack_push(ctx, (void*)(long)(left ^ (int)(long) op_stack_pop(ctx)));
             break;
 
         case SHIFT_AL:
-            op_stack_push(ctx, (void*)(long)(((int)(long) op_stack_pop(ctx)) << ((int)(long) op_stack_pop(ctx))));
+            left = (int)(long) op_stack_pop(ctx);
+            op_stack_push(ctx, (void*)(long)(left << (int)(long) op_stack_pop(ctx)));
             break;
 
         case SHIFT_AR:
-            op_stack_push(ctx, (void*)(long)(((int)(long) op_stack_pop(ctx)) >> ((int)(long) op_stack_pop(ctx))));
+            left = (int)(long) op_stack_pop(ctx);
+            op_stack_push(ctx, (void*)(long)(left >> (int)(long) op_stack_pop(ctx)));
             break;
 
         case EQUALS:
@@ -519,19 +1068,23 @@ void decode_and_execute(Context* ctx, u_int8_t* inst){
             break;
 
         case LESS:
-            op_stack_push(ctx, (void*)(long)(((int)(long) op_stack_pop(ctx)) < ((int)(long) op_stack_pop(ctx))));
+            left = (int)(long) op_stack_pop(ctx);
+            op_stack_push(ctx, (void*)(long)(left < (int)(long) op_stack_pop(ctx)));
             break;
 
         case GREATER:
-            op_stack_push(ctx, (void*)(long)(((int)(long) op_stack_pop(ctx)) > ((int)(long) op_stack_pop(ctx))));
+            left = (int)(long) op_stack_pop(ctx);
+            op_stack_push(ctx, (void*)(long)(left > (int)(long) op_stack_pop(ctx)));
             break;
 
         case LESS_EQ:
-            op_stack_push(ctx, (void*)(long)(((int)(long) op_stack_pop(ctx)) <= ((int)(long) op_stack_pop(ctx))));
+            left = (int)(long) op_stack_pop(ctx);
+            op_stack_push(ctx, (void*)(long)(left <= (int)(long) op_stack_pop(ctx)));
             break;
 
         case GREATER_EQ:
-            op_stack_push(ctx, (void*)(long)(((int)(long) op_stack_pop(ctx)) >= ((int)(long) op_stack_pop(ctx))));
+            left = (int)(long) op_stack_pop(ctx);
+            op_stack_push(ctx, (void*)(long)(left >= (int)(long) op_stack_pop(ctx)));
             break;
 
         case ADD_F:
@@ -550,6 +1103,89 @@ void decode_and_execute(Context* ctx, u_int8_t* inst){
             operate_f(ctx, &div_f);
             break;
 
+        case ADD_L:
+            operate_l(ctx, &add_l);
+            break;
+
+        case SUB_L:
+            operate_l(ctx, &sub_l);
+            break;
+
+        case MUL_L:
+            operate_l(ctx, &mul_l);
+            break;
+
+        case DIV_L:
+            divide_l(ctx, FALSE);
+            break;
+
+        case REM_L:
+            divide_l(ctx, TRUE);
+            break;
+
+        case NEG_L:
+            op_stack_push(ctx, (void*)(0UL - (unsigned long) op_stack_pop(ctx)));
+            break;
+
+        case AND_L:
+            operate_l(ctx, &and_l);
+            break;
+
+        case OR_L:
+            operate_l(ctx, &or_l);
+            break;
+
+        case XOR_L:
+            operate_l(ctx, &xor_l);
+            break;
+
+        case SHIFT_LL:
+            operate_l(ctx, &shift_ll);
+            break;
+
+        case SHIFT_RL:
+            operate_l(ctx, &shift_rl);
+            break;
+
+        case CMP_L:
+            operate_l(ctx, &cmp_l);
+            break;
+
+        case ADD_D:
+            operate_d(ctx, &add_d);
+            break;
+
+        case SUB_D:
+            operate_d(ctx, &sub_d);
+            break;
+
+        case MUL_D:
+            operate_d(ctx, &mul_d);
+            break;
+
+        case DIV_D:
+            operate_d(ctx, &div_d);
+            break;
+
+        case NEG_D:
+            op_stack_push(ctx, (void*) interpret_long(-interpret_double((long) op_stack_pop(ctx))));
+            break;
+
+        case CMP_D:
+            cmp_d(ctx);
+            break;
+
+        case I2L:
+        case L2I:
+        case I2D:
+        case D2I:
+        case L2D:
+        case D2L:
+        case F2D:
+        case D2F:
+            convert(ctx, opc);
+            break;
+
         default:
             fprintf(stderr, "%s%d", "unsupported opcode ", opc);
             exit(-1);
@@ -557,16 +1193,45 @@ void decode_and_execute(Context* ctx, u_int8_t* inst){
 }
 
 void FDE_cycle(Context* ctx){
+    jmp_buf unwind;
+    jmp_buf* outer = get_unwind_target(ctx);
+    set_unwind_target(ctx, &unwind);
+
+    /* a caught exception resumes here with the handler's frame on top, an exceeded budget stops the loop */
+    if (setjmp(unwind) == 2){
+        set_unwind_target(ctx, outer);
+        return;
+    }
+
     while (!frame_stack_is_empty(ctx)){
         u_int8_t* instruction = fetch(ctx);
         decode_and_execute(ctx, instruction);
     }
+    set_unwind_target(ctx, outer);
 }
 
-int exec(char* file_name){
+void* run_function(Context* ctx, V_Function* function, void** args, int argc){
+    push_frame(ctx, function);
+    for (int i = argc-1; i >= 0; i--) op_stack_push(ctx, args[i]);
+    FDE_cycle(ctx);
+    /* an exceeded budget leaves the frames of the call behind */
+    while (!frame_stack_is_empty(ctx))
+        pop_frame(ctx);
+    return get_result(ctx);
+}
+
+int exec_with_budget(char* file_name, Budget* budget){
     Context* ctx = init_components(file_name);
+    set_budget(ctx, budget);
     invoke_virtual(ctx, get_main_address(ctx), 0);
+    if (get_debugger(ctx) != NULL)
+        debug_stop(ctx);
     FDE_cycle(ctx);
+    int status = get_exit_status(ctx);
     clean_up(ctx);
-    return 0;
+    return status;
+}
+
+int exec(char* file_name){
+    return exec_with_budget(file_name, NULL);
 }
@@ -1,5 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include "budget.h"
 
 
 int exec(char* file_name);
+
+/* runs 'file_name' within 'budget' (NULL for none) and returns one of the EXEC_* statuses */
+int exec_with_budget(char* file_name, Budget* budget);
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "trace.h"
+
+#define DEFAULT_EVENTS (1 << 16)
+
+static volatile sig_atomic_t dump_requested = 0;
+static atomic_int next_id = 1;
+static atomic_uint sample_seed = 0;
+
+
+void on_dump_signal(int sig){
+    (void) sig;
+    dump_requested = 1;
+}
+
+long trace_now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+int sampled(){
+    char* sample = getenv("RABBIT_TRACE_SAMPLE");
+    if (sample == NULL) return 1;
+    double rate = atof(sample);
+
+    /* the sampler keeps its own generator so the program's rand() sequence is left alone */
+    unsigned int seed = atomic_load(&sample_seed);
+    unsigned int next;
+    int value;
+    do {
+        next = seed != 0 ? seed : (unsigned int)(trace_now() ^ getpid());
+        value = rand_r(&next);
+    } while (!atomic_compare_exchange_weak(&sample_seed, &seed, next));
+    return value < rate * ((double)RAND_MAX + 1);
+}
+
+Trace* trace_open(){
+    char* path = getenv("RABBIT_TRACE");
+    if (path == NULL || !sampled()) return NULL;
+
+    unsigned long capacity = DEFAULT_EVENTS;
+    char* events = getenv("RABBIT_TRACE_EVENTS");
+    if (events != NULL && atol(events) > 0) {
+        /* round up so the head can be masked instead of divided */
+        capacity = 1;
+        while (capacity < (unsigned long) atol(events)) capacity <<= 1;
+    }
+
+    Trace* trace = malloc(sizeof(Trace));
+    trace->path = strdup(path);
+    trace->id = atomic_fetch_add(&next_id, 1);
+    trace->capacity = capacity;
+    atomic_init(&trace->head, 0);
+    trace->events = malloc(sizeof(Trace_Event) * capacity);
+
+    signal(SIGUSR1, on_dump_signal);
+    return trace;
+}
+
+/* single producer per context: the slot is filled before the head is published */
+void trace_event(Trace* trace, u_int8_t kind, const char* name, long arg){
+    unsigned long head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    Trace_Event* event = &trace->events[head & (trace->capacity - 1)];
+    event->kind = kind;
+    event->name = name;
+    event->timestamp = trace_now();
+    event->arg = arg;
+    atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+}
+
+void trace_poll(Trace* trace){
+    if (dump_requested){
+        dump_requested = 0;
+        trace_dump(trace);
+    }
+}
+
+void write_name(FILE* out, const char* name){
+    fputc('"', out);
+    for (const char* c = name == NULL ? "?" : name; *c != '\0'; c++){
+        if (*c == '"' || *c == '\\') fputc('\\', out);
+        fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+void write_event(FILE* out, Trace* trace, Trace_Event* event){
+    static const char* phases[] = {"B", "E", "X", "i", "i"};
+    static const char* categories[] = {"call", "call", "native", "alloc", "gc"};
+
+    long ts = event->kind == TRACE_NATIVE ? event->arg : event->timestamp;
+    fprintf(out, "{\"name\":");
+    write_name(out, event->name);
+    fprintf(out, ",\"cat\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+            categories[event->kind], phases[event->kind], ts / 1000.0, getpid(), trace->id);
+
+    switch (event->kind) {
+        case TRACE_NATIVE:
+            fprintf(out, ",\"dur\":%.3f", (event->timestamp - event->arg) / 1000.0);
+            break;
+        case TRACE_ALLOC:
+            fprintf(out, ",\"s\":\"t\",\"args\":{\"bytes\":%ld}", event->arg);
+            break;
+        case TRACE_GC:
+            fprintf(out, ",\"s\":\"p\"");
+            break;
+        default:
+            break;
+    }
+    fputc('}', out);
+}
+
+void trace_dump(Trace* trace){
+    FILE* out = fopen(trace->path, "w");
+    if (out == NULL){
+        fprintf(stderr, "%s%s%s", "can not write trace to '", trace->path, "'\n");
+        return;
+    }
+
+    unsigned long head = atomic_load_explicit(&trace->head, memory_order_acquire);
+    unsigned long first = head > trace->capacity ? head - trace->capacity : 0;
+
+    fprintf(out, "{\"traceEvents\":[\n");
+    for (unsigned long i = first; i < head; i++){
+        write_event(out, trace, &trace->events[i & (trace->capacity - 1)]);
+        fprintf(out, i + 1 < head ? ",\n" : "\n");
+    }
+    fprintf(out, "],\"displayTimeUnit\":\"ns\"}\n");
+    fclose(out);
+}
+
+void trace_close(Trace* trace){
+    trace_dump(trace);
+    free(trace->path);
+    free(trace->events);
+    free(trace);
+}
+
+void trace_fork(Trace* trace){
+    char* path = malloc(strlen(trace->path) + 24);
+    sprintf(path, "%s.%d", trace->path, (int) getpid());
+    free(trace->path);
+    trace->path = path;
+}
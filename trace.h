@@ -0,0 +1,46 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+
+/*
+ * Opt-in timeline tracing. Enabled by setting RABBIT_TRACE to an output path;
+ * RABBIT_TRACE_SAMPLE (0..1) traces only that fraction of runs and
+ * RABBIT_TRACE_EVENTS sizes the ring buffer. The buffer keeps the most recent
+ * events and is written as Chrome trace JSON at shutdown or on SIGUSR1.
+ */
+enum Trace_Kind {
+    TRACE_ENTER,
+    TRACE_EXIT,
+    TRACE_NATIVE,
+    TRACE_ALLOC,
+    TRACE_GC,
+};
+
+typedef struct trace_event {
+    u_int8_t kind;
+    const char* name;
+    long timestamp;
+    long arg;
+} Trace_Event;
+
+typedef struct trace {
+    char* path;
+    int id;
+    unsigned long capacity;
+    atomic_ulong head;
+    Trace_Event* events;
+} Trace;
+
+Trace* trace_open();
+
+long trace_now();
+
+void trace_event(Trace* trace, u_int8_t kind, const char* name, long arg);
+
+void trace_poll(Trace* trace);
+
+void trace_dump(Trace* trace);
+
+void trace_close(Trace* trace);
+
+/* a forked child writes its trace to <path>.<pid> instead of the parent's file */
+void trace_fork(Trace* trace);
@@ -5,3 +5,13 @@ void error(char* msg){
     fprintf(stderr, "%s", msg);
     exit(0);
 }
+
+static __thread long allocated = 0;
+
+void note_allocation(long bytes){
+    allocated += bytes;
+}
+
+long allocated_bytes(){
+    return allocated;
+}
@@ -6,4 +6,9 @@ typedef int bool;
 
 void error(char* msg);
 
+/* tallies the bytes the runtime helpers allocate on the calling thread */
+void note_allocation(long bytes);
+
+long allocated_bytes();
+
 
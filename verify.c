@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "pool.h"
+#include "env.h"
+#include "rni.h"
+#include "opcodes.h"
+#include "verify.h"
+
+enum Operand {
+    OPERAND_NONE,
+    OPERAND_BYTE,
+    OPERAND_LOCAL,
+    OPERAND_CONST,
+    OPERAND_TYPE,
+    OPERAND_COUNT,
+    OPERAND_FUNCTION,
+    OPERAND_TEMPLATE,
+    OPERAND_NATIVE,
+    OPERAND_BRANCH,
+    OPERAND_SHORT,
+    OPERAND_PARALLEL,
+    OPERAND_SWITCH,
+};
+
+typedef struct opcode_info {
+    int length;
+    int pops;
+    int pushes;
+    u_int8_t operand;
+} Opcode_Info;
+
+#define BINARY {1, 2, 1, OPERAND_NONE}
+#define UNARY {1, 1, 1, OPERAND_NONE}
+
+static Opcode_Info opcodes[] = {
+        [PUSH_NULL] = {1, 0, 1, OPERAND_NONE},
+        [PUSH_INT] = {2, 0, 1, OPERAND_BYTE},
+        [LOAD_CONST] = {2, 0, 1, OPERAND_CONST},
+        [LOAD_LOCAl] = {2, 0, 1, OPERAND_LOCAL},
+        [STORE_LOCAL] = {2, 1, 0, OPERAND_LOCAL},
+        [NEW] = {2, 0, 1, OPERAND_TYPE},
+        [FREE] = {1, 1, 0, OPERAND_NONE},
+        [NULL_CHECK] = UNARY,
+        [CHECK_CAST] = {2, 1, 1, OPERAND_TYPE},
+        [I2F] = UNARY,
+        [F2I] = UNARY,
+        [MAKE_ARRAY] = {2, 0, 1, OPERAND_COUNT},
+        [READ_ARRAY] = {2, 1, 1, OPERAND_BYTE},
+        [WRITE_ARRAY] = {2, 2, 0, OPERAND_BYTE},
+        [GET_FIELD] = {2, 1, 1, OPERAND_BYTE},
+        [PUT_FIELD] = {2, 2, 0, OPERAND_BYTE},
+        [INVOKE_VIRTUAL] = {3, 0, 1, OPERAND_FUNCTION},
+        [INVOKE_TEMPLATE] = {3, 1, 1, OPERAND_TEMPLATE},
+        [INVOKE_NATIVE] = {3, 0, 1, OPERAND_NATIVE},
+        [RETURN] = {1, 1, 0, OPERAND_NONE},
+        [DUP] = {1, 1, 2, OPERAND_NONE},
+        [SWAP] = {1, 2, 2, OPERAND_NONE},
+        [POP] = {1, 1, 0, OPERAND_NONE},
+        [NOT] = UNARY,
+        [NEG] = UNARY,
+        [ADD_I] = BINARY,
+        [SUB_I] = BINARY,
+        [MUL_I] = BINARY,
+        [MOD] = BINARY,
+        [AND] = BINARY,
+        [OR] = BINARY,
+        [AND_BIT] = BINARY,
+        [OR_BIT] = BINARY,
+        [XOR] = BINARY,
+        [SHIFT_AL] = BINARY,
+        [SHIFT_AR] = BINARY,
+        [ADD_F] = BINARY,
+        [SUB_F] = BINARY,
+        [MUL_F] = BINARY,
+        [DIV] = BINARY,
+        [EQUALS] = BINARY,
+        [NOT_EQUALS] = BINARY,
+        [LESS] = BINARY,
+        [GREATER] = BINARY,
+        [LESS_EQ] = BINARY,
+        [GREATER_EQ] = BINARY,
+        [GOTO] = {3, 0, 0, OPERAND_BRANCH},
+        [BRANCH_NOT_ZERO] = {3, 1, 0, OPERAND_BRANCH},
+        [BRANCH_ZERO] = {3, 1, 0, OPERAND_BRANCH},
+        [NEW_LINE] = {3, 0, 0, OPERAND_SHORT},
+        [THROW] = {1, 1, 0, OPERAND_NONE},
+        [PAR_MAP] = {2, 1, 1, OPERAND_PARALLEL},
+        [PAR_FILTER] = {2, 1, 1, OPERAND_PARALLEL},
+        [PAR_REDUCE] = {2, 2, 1, OPERAND_PARALLEL},
+        [TABLESWITCH] = {8, 1, 0, OPERAND_SWITCH},
+        [LOOKUPSWITCH] = {4, 1, 0, OPERAND_SWITCH},
+        [GET_FIELD_I8] = {2, 1, 1, OPERAND_BYTE},
+        [GET_FIELD_I32] = {2, 1, 1, OPERAND_BYTE},
+        [GET_FIELD_F32] = {2, 1, 1, OPERAND_BYTE},
+        [PUT_FIELD_I8] = {2, 2, 0, OPERAND_BYTE},
+        [PUT_FIELD_I32] = {2, 2, 0, OPERAND_BYTE},
+        [PUT_FIELD_F32] = {2, 2, 0, OPERAND_BYTE},
+        [ADD_L] = BINARY,
+        [SUB_L] = BINARY,
+        [MUL_L] = BINARY,
+        [DIV_L] = BINARY,
+        [REM_L] = BINARY,
+        [NEG_L] = UNARY,
+        [AND_L] = BINARY,
+        [OR_L] = BINARY,
+        [XOR_L] = BINARY,
+        [SHIFT_LL] = BINARY,
+        [SHIFT_RL] = BINARY,
+        [ADD_D] = BINARY,
+        [SUB_D] = BINARY,
+        [MUL_D] = BINARY,
+        [DIV_D] = BINARY,
+        [NEG_D] = UNARY,
+        [CMP_L] = BINARY,
+        [CMP_D] = BINARY,
+        [I2L] = UNARY,
+        [L2I] = UNARY,
+        [I2D] = UNARY,
+        [D2I] = UNARY,
+        [L2D] = UNARY,
+        [D2L] = UNARY,
+        [F2D] = UNARY,
+        [D2F] = UNARY,
+        /* only produced by the optimizer, opcode_length still rejects it in an image */
+        [PUSH_CONST] = {0, 0, 1, OPERAND_NONE},
+};
+
+#define OPCODES_COUNT (sizeof(opcodes) / sizeof(Opcode_Info))
+
+
+int opcode_length(u_int8_t opcode){
+    if (opcode >= OPCODES_COUNT || opcodes[opcode].length == 0)
+        return -1;
+    return opcodes[opcode].length;
+}
+
+/* the length of an instruction including its jump table; the fixed part must be present */
+int instruction_length(u_int8_t* inst){
+    if (inst[0] == TABLESWITCH) return 8 + 2 * inst[7];
+    if (inst[0] == LOOKUPSWITCH) return 4 + 6 * inst[3];
+    return opcodes[inst[0]].length;
+}
+
+/* pushes minus pops of 'inst', without checking its operands */
+int stack_effect(u_int8_t* inst){
+    Opcode_Info* info = &opcodes[inst[0]];
+    switch (info->operand) {
+        case OPERAND_COUNT:
+            return info->pushes - inst[1];
+        case OPERAND_FUNCTION:
+        case OPERAND_NATIVE:
+            return info->pushes - inst[2];
+        case OPERAND_TEMPLATE:
+            return info->pushes - info->pops - inst[2];
+        default:
+            return info->pushes - info->pops;
+    }
+}
+
+void reject(V_Function* function, int ip, char* msg){
+    fprintf(stderr, "%s%s%s%s%s%d%s", "invalid bytecode: ", msg, " (in ", function->name, ": instruction ", ip, ")");
+    exit(-1);
+}
+
+void* pool_operand(Pool* pool, V_Function* function, int ip, int idx, int tag){
+    if (idx >= pool->size || pool->tags[idx] != tag)
+        reject(function, ip, "constant-pool operand has the wrong tag");
+    return pool->values[idx];
+}
+
+/* a verified function's stack depth was computed for its arity, which can not change afterwards */
+void require_arity(V_Function* caller, int ip, V_Function* callee, int argc){
+    if (callee->arity == -1 && !callee->verified)
+        callee->arity = argc;
+    else if (callee->arity != argc)
+        reject(caller, ip, "inconsistent argument count for function");
+}
+
+/* every implementation of a template method is called with the same arguments */
+void require_template_arity(Pool* pool, V_Function* caller, int ip, char* name, int argc){
+    for (int i = 0; i < pool->size; i++){
+        if (pool->tags[i] != 5) continue;
+        V_Method_Table* methods = ((Type*) pool->values[i])->v_methods;
+        if (methods == NULL) continue;
+
+        for (int j = 0; j < methods->size; j++){
+            if (strcmp(methods->names[j], name) != 0) continue;
+            V_Function* impl = pool_operand(pool, caller, ip, methods->addresses[j], 3);
+            require_arity(caller, ip, impl, argc);
+        }
+    }
+}
+
+int int_from_2_bytes(u_int8_t b1, u_int8_t b2){
+    return ((b1 & 0xff) << 8) | (b2 & 0xff);
+}
+
+int int_from_4_bytes(u_int8_t* bytes){
+    u_int32_t value = ((u_int32_t) bytes[0] << 24) | ((u_int32_t) bytes[1] << 16) | ((u_int32_t) bytes[2] << 8) | bytes[3];
+    return (int) value;
+}
+
+int switch_count(u_int8_t* inst){
+    return inst[0] == TABLESWITCH ? inst[7] : inst[3];
+}
+
+/* target i of a switch, -1 being the default */
+int switch_target(u_int8_t* inst, int i){
+    if (i == -1) return int_from_2_bytes(inst[1], inst[2]);
+    if (inst[0] == TABLESWITCH) return int_from_2_bytes(inst[8 + 2*i], inst[9 + 2*i]);
+    return int_from_2_bytes(inst[8 + 6*i], inst[9 + 6*i]);
+}
+
+int switch_key(u_int8_t* inst, int i){
+    return int_from_4_bytes(inst + 4 + 6*i);
+}
+
+/* checks the operand of 'inst' and returns how many values it pops */
+int check_operand(Pool* pool, V_Function* function, int ip, u_int8_t* inst){
+    Opcode_Info* info = &opcodes[inst[0]];
+
+    switch (info->operand) {
+        case OPERAND_LOCAL:
+            if (inst[1] >= function->locals)
+                reject(function, ip, "local variable index out of range");
+            break;
+
+        case OPERAND_CONST:
+        {
+            if (inst[1] >= pool->size)
+                reject(function, ip, "constant-pool index out of range");
+            int tag = pool->tags[inst[1]];
+            if (tag != 0 && tag != 1 && tag != 2 && tag != 7 && tag != 8)
+                reject(function, ip, "constant-pool operand has the wrong tag");
+        }
+            break;
+
+        case OPERAND_TYPE:
+            pool_operand(pool, function, ip, inst[1], 5);
+            break;
+
+        case OPERAND_COUNT:
+            return inst[1];
+
+        case OPERAND_FUNCTION:
+            require_arity(function, ip, pool_operand(pool, function, ip, inst[1], 3), inst[2]);
+            return inst[2];
+
+        case OPERAND_TEMPLATE:
+            require_template_arity(pool, function, ip, pool_operand(pool, function, ip, inst[1], 6), inst[2]);
+            return info->pops + inst[2];
+
+        case OPERAND_NATIVE:
+            if (rni_lookup(pool_operand(pool, function, ip, inst[1], 4))->argc != inst[2])
+                reject(function, ip, "invalid argument count for native function");
+            return inst[2];
+
+        case OPERAND_PARALLEL:
+            require_arity(function, ip, pool_operand(pool, function, ip, inst[1], 3), inst[0] == PAR_REDUCE ? 2 : 1);
+            break;
+
+        case OPERAND_SWITCH:
+            for (int i = -1; i < switch_count(inst); i++){
+                if (switch_target(inst, i) >= function->length)
+                    reject(function, ip, "branch target out of range");
+                if (inst[0] == LOOKUPSWITCH && i > 0 && switch_key(inst, i - 1) >= switch_key(inst, i))
+                    reject(function, ip, "lookup switch keys are not sorted");
+            }
+            break;
+
+        case OPERAND_BRANCH:
+            if (int_from_2_bytes(inst[1], inst[2]) >= function->length)
+                reject(function, ip, "branch target out of range");
+            break;
+
+        default:
+            break;
+    }
+    return info->pops;
+}
+
+void merge(V_Function* function, int* depths, int* worklist, int* pending, int target, int depth){
+    if (depths[target] == -1){
+        depths[target] = depth;
+        worklist[(*pending)++] = target;
+    }
+    else if (depths[target] != depth){
+        reject(function, target, "stack height differs between incoming branches");
+    }
+}
+
+void verify_function(Pool* pool, V_Function* function){
+    if (function->verified) return;
+
+    int length = function->length;
+    if (length == 0)
+        reject(function, 0, "function has no instructions");
+
+    int* depths = malloc(sizeof(int) * length);
+    int* worklist = malloc(sizeof(int) * length);
+    for (int i = 0; i < length; i++) depths[i] = -1;
+
+    int pending = 0;
+    int arity = function->arity == -1 ? 0 : function->arity;
+    int max_depth = arity;
+    merge(function, depths, worklist, &pending, 0, arity);
+
+    /* a handler starts on an emptied stack holding only the exception */
+    for (int i = 0; i < function->handler_count; i++){
+        Handler* handler = &function->handlers[i];
+        if (handler->start >= handler->end || handler->end > length || handler->target >= length)
+            reject(function, handler->target, "exception handler range out of bounds");
+        merge(function, depths, worklist, &pending, handler->target, 1);
+        if (max_depth < 1) max_depth = 1;
+    }
+
+    while (pending > 0){
+        int ip = worklist[--pending];
+        u_int8_t* inst = function->instructions[ip];
+
+        int pops = check_operand(pool, function, ip, inst);
+        int depth = depths[ip] - pops;
+        if (depth < 0)
+            reject(function, ip, "operand stack underflow");
+        depth += opcodes[inst[0]].pushes;
+        if (depth > max_depth) max_depth = depth;
+
+        u_int8_t opc = inst[0];
+        if (opc == RETURN || opc == THROW) continue;
+
+        if (opc == TABLESWITCH || opc == LOOKUPSWITCH){
+            for (int i = -1; i < switch_count(inst); i++)
+                merge(function, depths, worklist, &pending, switch_target(inst, i), depth);
+            continue;
+        }
+
+        if (opc == GOTO || opc == BRANCH_ZERO || opc == BRANCH_NOT_ZERO)
+            merge(function, depths, worklist, &pending, int_from_2_bytes(inst[1], inst[2]), depth);
+
+        if (opc != GOTO){
+            if (ip + 1 >= length)
+                reject(function, ip, "execution falls off the end of the function");
+            merge(function, depths, worklist, &pending, ip + 1, depth);
+        }
+    }
+
+    free(depths);
+    free(worklist);
+
+    if (max_depth > 255)
+        reject(function, 0, "operand stack exceeds 255 slots");
+    function->op_stack = max_depth;
+    function->verified = TRUE;
+}
+
+/* verifies every function reachable from main, following the arities found at call sites */
+void verify_reachable(Pool* pool, int main_addr){
+    if (main_addr >= pool->size || pool->tags[main_addr] != 3)
+        error("main address does not refer to a function");
+    ((V_Function*) pool->values[main_addr])->arity = 0;
+
+    bool changed = TRUE;
+    while (changed){
+        changed = FALSE;
+        for (int i = 0; i < pool->size; i++){
+            if (pool->tags[i] != 3) continue;
+            V_Function* function = pool->values[i];
+            if (function->verified || function->arity == -1) continue;
+            verify_function(pool, function);
+            changed = TRUE;
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#include <stdlib.h>
+
+/*
+ * Load-time bytecode verification. A verified function only references valid
+ * locals, pool entries of the right tag and in-range branch targets, never
+ * underflows its operand stack, reaches every merge point with one stack
+ * height and cannot fall off its end. Its op_stack is set to the exact maximum
+ * depth, so the interpreter does not check stack bounds, local slots or pool
+ * indices. What a value holds is not tracked: array indices, casts, field
+ * kinds, long divisors and native arguments are checked when used, and a null
+ * reference only by NULL_CHECK.
+ */
+struct pool;
+struct v_function;
+
+int opcode_length(u_int8_t opcode);
+
+/* two byte big-endian operand: branch targets and line numbers */
+int int_from_2_bytes(u_int8_t b1, u_int8_t b2);
+
+/* four byte big-endian operand: switch keys and the low bound of a table switch */
+int int_from_4_bytes(u_int8_t* bytes);
+
+int instruction_length(u_int8_t* inst);
+
+int stack_effect(u_int8_t* inst);
+
+int switch_count(u_int8_t* inst);
+
+/* target i of a switch, -1 being the default */
+int switch_target(u_int8_t* inst, int i);
+
+int switch_key(u_int8_t* inst, int i);
+
+void verify_function(struct pool* pool, struct v_function* function);
+
+void verify_reachable(struct pool* pool, int main_addr);
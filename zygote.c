@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "env.h"
+#include "str.h"
+#include "io.h"
+#include "parallel.h"
+#include "zygote.h"
+
+
+V_Function* require_entry_point(Context* ctx, char* name, int argc){
+    V_Function* function = find_entry_point(ctx, name, argc);
+    if (function == NULL){
+        fprintf(stderr, "%s%s%s%d%s", "no function ", name, " taking ", argc, " arguments\n");
+        exit(-1);
+    }
+    return function;
+}
+
+void serve_request(Context* ctx, Budget* budget, V_Function* entry, void* state, View* request){
+    detach_child(ctx);
+    set_budget(ctx, budget);
+
+    void* args[2] = {state, string_new(request->chars, (int) request->length)};
+    /* the following requests are the parent's to read */
+    stream_detach_stdin();
+    run_function(ctx, entry, args, 2);
+    close_child(ctx);
+    fflush(NULL);
+    _exit(get_exit_status(ctx));
+}
+
+int serve(char* file_name, Budget* budget, char* init_name, char* entry_name){
+    Context* ctx = init_components(file_name);
+    set_budget(ctx, budget);
+    V_Function* entry = require_entry_point(ctx, entry_name, 2);
+
+    void* state = NULL;
+    if (init_name != NULL){
+        state = run_function(ctx, require_entry_point(ctx, init_name, 0), NULL, 0);
+        if (get_exit_status(ctx) != EXEC_OK){
+            int status = get_exit_status(ctx);
+            clean_up(ctx);
+            return status;
+        }
+    }
+
+    /* decoded once here instead of once per child */
+    prepare_referenced(ctx);
+
+    int status = EXEC_OK;
+    View* request;
+    while ((request = stream_read_line(stream_stdin())) != NULL){
+        /* buffered output would otherwise be written by the child as well */
+        fflush(NULL);
+        pid_t pid = fork();
+        if (pid == -1){
+            perror("fork");
+            exit(-1);
+        }
+        if (pid == 0)
+            serve_request(ctx, budget, entry, state, request);
+
+        int child;
+        waitpid(pid, &child, 0);
+        if (!WIFEXITED(child))
+            status = -1;
+        else if (WEXITSTATUS(child) != 0)
+            status = WEXITSTATUS(child);
+    }
+
+    clean_up(ctx);
+    return status;
+}
@@ -0,0 +1,18 @@
+#include <stdlib.h>
+
+/*
+ * Zygote mode: the image is loaded and the init function run once, then every
+ * line read from stdin is served by a forked copy of the warmed process, which
+ * calls the entry function with the init function's result on top and the line
+ * (as a string) below it. Children share the decoded code and whatever init
+ * built copy-on-write, so a request pays neither for loading nor for init.
+ * A child sees an empty stdin, writes its trace (RABBIT_TRACE) to <path>.<pid>
+ * and reports its own heap profile.
+ *
+ * Requests are served one after another so their output stays in order, each
+ * within its own 'budget'. Returns EXEC_OK, or the exit status of the last
+ * request that failed.
+ */
+struct budget;
+
+int serve(char* file_name, struct budget* budget, char* init_name, char* entry_name);